@@ -0,0 +1,304 @@
+/*
+ * Bulk_Evaluation.cc
+ */
+#include "Bulk_Evaluation.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <limits>
+#include <ostream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+  // Ungefärlig storlek på den bit av texten som en tråd hämtar åt gången;
+  // många fler bitar än trådar jämnar ut skillnader i radlängd.
+  constexpr std::size_t chunk_size{256 * 1024};
+
+  struct Chunk
+  {
+    std::size_t         begin;
+    std::size_t         end;     // direkt efter ett radslut eller textens slut
+    vector<long double> values{};
+    vector<Bulk_Error>  errors{};
+  };
+
+  vector<Chunk> split(string_view text)
+  {
+    vector<Chunk> chunks;
+    std::size_t   begin{0};
+    while (begin < text.size())
+      {
+        std::size_t end{text.size()};
+        if (text.size() - begin > chunk_size)
+          {
+            std::size_t newline{text.find('\n', begin + chunk_size)};
+            if (newline != string_view::npos)
+              {
+                end = newline + 1;
+              }
+          }
+        chunks.push_back(Chunk{begin, end});
+        begin = end;
+      }
+    return chunks;
+  }
+
+  // En rad räknas i uttryckets taltyp (Expression_Options::number_type),
+  // med en miljö av samma typ.
+  template<typename T>
+  Expression_Status evaluate_in(const Expression& expression, const Bulk_Options& options,
+                                long double& value)
+  {
+    vector<T> environment{expression.make_environment<T>()};
+    for (const auto& variable : options.variables)
+      {
+        std::size_t slot{expression.find_variable(variable.first)};
+        if (slot != Symbol_Table::npos)
+          {
+            environment[slot] = static_cast<T>(variable.second);
+          }
+      }
+    T                 result{};
+    Expression_Status status{expression.try_evaluate(environment.data(), result)};
+    value = result;
+    return status;
+  }
+
+  void evaluate_chunk(string_view text, Chunk& chunk, const Bulk_Options& options)
+  {
+    std::size_t position{chunk.begin};
+    while (position < chunk.end)
+      {
+        std::size_t newline{text.find('\n', position)};
+        std::size_t end{min(newline, chunk.end)};
+        string_view line{text.substr(position, end - position)};
+        if (!line.empty() && line.back() == '\r')
+          {
+            line.remove_suffix(1);
+          }
+        position = end + 1;
+
+        // Felaktiga rader går samma väg som korrekta, utan undantag.
+        Expression        expression;
+        long double       value{};
+        Expression_Status status{try_make_expression(line, expression, options.options)};
+        if (status)
+          {
+            switch (expression.number_type())
+              {
+              case Number_Type::float_type:
+                status = evaluate_in<float>(expression, options, value);
+                break;
+              case Number_Type::double_type:
+                status = evaluate_in<double>(expression, options, value);
+                break;
+              case Number_Type::long_double_type:
+                status = evaluate_in<long double>(expression, options, value);
+                break;
+              }
+          }
+
+        if (status)
+          {
+            chunk.values.push_back(value);
+          }
+        else
+          {
+            // Tolkarens meddelanden slutar med radbrytning.
+            string_view message{status.message()};
+            while (!message.empty() && message.back() == '\n')
+              {
+                message.remove_suffix(1);
+              }
+            chunk.errors.push_back(Bulk_Error{chunk.values.size(), string{message}});
+            chunk.values.push_back(numeric_limits<long double>::quiet_NaN());
+          }
+      }
+  }
+
+  // Mappningen släpps även om utvärderingen kastar ett undantag.
+  struct Mapping
+  {
+    void*       data{MAP_FAILED};
+    std::size_t size{0};
+
+    ~Mapping()
+    {
+      if (data != MAP_FAILED)
+        {
+          munmap(data, size);
+        }
+    }
+  };
+}
+
+Bulk_Result evaluate_lines(std::string_view text, const Bulk_Options& options)
+{
+  vector<Chunk> chunks{split(text)};
+
+  unsigned thread_count{options.threads != 0 ? options.threads : thread::hardware_concurrency()};
+  thread_count = static_cast<unsigned>(min<std::size_t>(max(thread_count, 1u), chunks.size()));
+
+  atomic<std::size_t> next{0};
+  exception_ptr       failure;
+  atomic<bool>        failed{false};
+  auto work = [&]
+  {
+    try
+      {
+        for (std::size_t i{next++}; i < chunks.size() && !failed; i = next++)
+          {
+            evaluate_chunk(text, chunks[i], options);
+          }
+      }
+    catch (...)
+      {
+        // Bara fel utanför en enskild rad, t.ex. slut på minne, hamnar här.
+        if (!failed.exchange(true))
+          {
+            failure = current_exception();
+          }
+      }
+  };
+
+  vector<thread> threads;
+  for (unsigned i{1}; i < thread_count; ++i)
+    {
+      threads.emplace_back(work);
+    }
+  work();
+  for (thread& t : threads)
+    {
+      t.join();
+    }
+  if (failure)
+    {
+      rethrow_exception(failure);
+    }
+
+  // Bitarnas rader läggs efter varandra i indatans ordning.
+  Bulk_Result result;
+  std::size_t line_count{0};
+  for (const Chunk& chunk : chunks)
+    {
+      line_count += chunk.values.size();
+    }
+  result.values.reserve(line_count);
+  for (Chunk& chunk : chunks)
+    {
+      std::size_t first_line{result.values.size()};
+      result.values.insert(result.values.end(), chunk.values.begin(), chunk.values.end());
+      for (Bulk_Error& error : chunk.errors)
+        {
+          error.line += first_line;
+          result.error_list.push_back(std::move(error));
+        }
+    }
+  return result;
+}
+
+Bulk_Result evaluate_file(const std::string& path, const Bulk_Options& options)
+{
+  int file{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (file < 0)
+    {
+      throw expression_error {"could not open " + path};
+    }
+
+  struct stat status{};
+  if (fstat(file, &status) != 0)
+    {
+      close(file);
+      throw expression_error {"could not read " + path};
+    }
+  if (status.st_size == 0)
+    {
+      close(file);
+      return evaluate_lines({}, options);
+    }
+
+  Mapping mapping;
+  mapping.size = static_cast<std::size_t>(status.st_size);
+  mapping.data = mmap(nullptr, mapping.size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (mapping.data == MAP_FAILED)
+    {
+      throw expression_error {"could not map " + path};
+    }
+  madvise(mapping.data, mapping.size, MADV_SEQUENTIAL);
+
+  return evaluate_lines({static_cast<const char*>(mapping.data), mapping.size}, options);
+}
+
+std::size_t Bulk_Result::size() const
+{
+  return values.size();
+}
+
+bool Bulk_Result::ok(std::size_t line) const
+{
+  return error(line).empty();
+}
+
+long double Bulk_Result::value(std::size_t line) const
+{
+  return values.at(line);
+}
+
+std::string_view Bulk_Result::error(std::size_t line) const
+{
+  auto it = lower_bound(error_list.begin(), error_list.end(), line,
+                        [](const Bulk_Error& error, std::size_t l) { return error.line < l; });
+  if (it == error_list.end() || it->line != line)
+    {
+      return {};
+    }
+  return it->message;
+}
+
+const std::vector<Bulk_Error>& Bulk_Result::errors() const
+{
+  return error_list;
+}
+
+void Bulk_Result::write(std::ostream& os, int precision) const
+{
+  // Raderna samlas i en buffert som skrivs i stora bitar.
+  constexpr std::size_t flush_size{64 * 1024};
+  string buffer;
+  buffer.reserve(flush_size + 256);
+  auto error = error_list.begin();
+
+  for (std::size_t line{0}; line < values.size(); ++line)
+    {
+      if (error != error_list.end() && error->line == line)
+        {
+          buffer += "error: ";
+          buffer += error->message;
+          ++error;
+        }
+      else
+        {
+          char text[64];
+          int  length{snprintf(text, sizeof text, "%.*Lg", precision, values[line])};
+          buffer.append(text, static_cast<std::size_t>(min<int>(length, sizeof text - 1)));
+        }
+      buffer += '\n';
+
+      if (buffer.size() >= flush_size)
+        {
+          os.write(buffer.data(), buffer.size());
+          buffer.clear();
+        }
+    }
+  os.write(buffer.data(), buffer.size());
+}
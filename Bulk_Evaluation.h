@@ -0,0 +1,69 @@
+/*
+ * Bulk_Evaluation.h
+ */
+#ifndef BULK_EVALUATION_H
+#define BULK_EVALUATION_H
+#include "Expression.h"
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Bulk_Options: Val för evaluate_lines och evaluate_file.
+ *   threads   - antal trådar; 0 betyder en per kärna.
+ *   options   - hur varje rad tolkas, som för make_expression, och i
+ *               vilken taltyp den räknas.
+ *   variables - värden som sätts på de variabler ett uttryck använder;
+ *               övriga variabler är 0.
+ */
+struct Bulk_Options
+{
+  unsigned                                         threads{0};
+  Expression_Options                               options{};
+  std::vector<std::pair<std::string, long double>> variables{};
+};
+
+struct Bulk_Error
+{
+  std::size_t line;      // räknat från 0
+  std::string message;
+};
+
+/**
+ * Bulk_Result: Ett värde per rad i indatans ordning. En rad som inte kunde
+ * tolkas eller utvärderas har NaN som värde och ett felmeddelande.
+ */
+class Bulk_Result
+{
+public:
+  std::size_t                    size() const;
+  bool                           ok(std::size_t line) const;
+  long double                    value(std::size_t line) const;
+  std::string_view               error(std::size_t line) const;
+  const std::vector<Bulk_Error>& errors() const;
+
+  // En rad per indatarad: värdet med precision siffror, eller "error: ...".
+  void write(std::ostream& os, int precision = 6) const;
+
+private:
+  friend Bulk_Result evaluate_lines(std::string_view, const Bulk_Options&);
+
+  std::vector<long double> values;
+  std::vector<Bulk_Error>  error_list;   // sorterade efter rad
+};
+
+/**
+ * evaluate_lines: Tolkar och utvärderar ett uttryck per rad. Texten delas i
+ * bitar vid radslut som trådarna hämtar efter hand; varje rad får en egen
+ * miljö. Fel på en rad sparas i resultatet och avbryter inte körningen.
+ * En avslutande tom rad efter sista radslutet räknas inte.
+ *
+ * evaluate_file: Samma sak för en fil, som mappas med mmap.
+ */
+Bulk_Result evaluate_lines(std::string_view text, const Bulk_Options& options = {});
+Bulk_Result evaluate_file(const std::string& path, const Bulk_Options& options = {});
+
+#endif
@@ -0,0 +1,989 @@
+/*
+ * Bytecode.cc
+ */
+#include "Bytecode.h"
+#include "Expression_Tree.h"
+#include "Instrumentation.h"
+#include "Thread_Pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+static_assert(static_cast<std::size_t>(Opcode::load_temporary) + 1 == instrumentation::opcode_count,
+              "instrumentation::opcode_count ska vara antalet Opcode");
+
+namespace
+{
+  // Det kastande gränssnittet byggs på det som ger felkoder.
+  void throw_if_failed(Error_Code error)
+  {
+    if (error == Error_Code::out_of_memory)
+      {
+        throw bad_alloc{};
+      }
+    if (error != Error_Code::none)
+      {
+        throw expression_tree_error {error_message(error)};
+      }
+  }
+
+  // Antal rader per block vid satsvis utvärdering. Kärnorna nedan arbetar
+  // alltid på hela block, så att slingorna har konstant längd och kan
+  // vektoriseras av kompilatorn; raderna efter sista giltiga rad fylls ut.
+  constexpr std::size_t block_size{256};
+
+  void fill_block(double* __restrict__ a, double value)
+  {
+    for (std::size_t i{0}; i < block_size; ++i)
+      a[i] = value;
+  }
+
+  void add_block(double* __restrict__ a, const double* __restrict__ b)
+  {
+    for (std::size_t i{0}; i < block_size; ++i)
+      a[i] += b[i];
+  }
+
+  void subtract_block(double* __restrict__ a, const double* __restrict__ b)
+  {
+    for (std::size_t i{0}; i < block_size; ++i)
+      a[i] -= b[i];
+  }
+
+  void multiply_block(double* __restrict__ a, const double* __restrict__ b)
+  {
+    for (std::size_t i{0}; i < block_size; ++i)
+      a[i] *= b[i];
+  }
+
+  void divide_block(double* __restrict__ a, const double* __restrict__ b)
+  {
+    for (std::size_t i{0}; i < block_size; ++i)
+      a[i] /= b[i];
+  }
+
+  void power_block(double* __restrict__ a, const double* __restrict__ b)
+  {
+    for (std::size_t i{0}; i < block_size; ++i)
+      a[i] = std::pow(a[i], b[i]);
+  }
+
+  // Hur en instruktion ändrar stackens djup.
+  int stack_effect(Opcode op)
+  {
+    switch (op)
+      {
+      case Opcode::push_constant:
+      case Opcode::load_variable:
+      case Opcode::load_temporary:
+        return 1;
+      case Opcode::save_temporary:
+      case Opcode::store_variable:
+        return 0;
+      default:
+        return -1;
+      }
+  }
+}
+
+void Bytecode::push_instruction(Opcode op, std::size_t arg, int stack_effect)
+{
+  code.push_back(Instruction{op, static_cast<std::uint32_t>(arg)});
+  depth += stack_effect;
+  if (depth > max_depth)
+    {
+      max_depth = depth;
+    }
+}
+
+void Bytecode::emit_constant(long double value)
+{
+  push_instruction(Opcode::push_constant, constants.size(), 1);
+  constants.push_back(value);
+  double_constants.push_back(static_cast<double>(value));
+  float_constants.push_back(static_cast<float>(value));
+}
+
+void Bytecode::emit_load(std::string_view name, long double initial_value)
+{
+  push_instruction(Opcode::load_variable, symbol_table.intern(name, initial_value), 1);
+}
+
+void Bytecode::emit_store(std::string_view name)
+{
+  // Värdet ligger kvar på stacken, en tilldelning har tilldelat värde som resultat.
+  push_instruction(Opcode::store_variable, symbol_table.intern(name), 0);
+}
+
+void Bytecode::emit(Opcode op)
+{
+  push_instruction(op, 0, -1);
+}
+
+bool Bytecode::recall(const Expression_Tree* node)
+{
+  auto it = temporaries.find(node);
+  if (it == temporaries.end())
+    {
+      return false;
+    }
+  push_instruction(Opcode::load_temporary, it->second, 1);
+  return true;
+}
+
+void Bytecode::remember(const Expression_Tree* node)
+{
+  temporaries.emplace(node, temporary_count);
+  push_instruction(Opcode::save_temporary, temporary_count, 0);
+  ++temporary_count;
+}
+
+std::size_t Bytecode::scratch_size() const
+{
+  // Stacken följd av de temporära registren.
+  return max_depth + temporary_count;
+}
+
+long double Bytecode::run() const
+{
+  if (code.empty())
+    {
+      throw expression_tree_error {"no expression tree"};
+    }
+
+  long double value{};
+  throw_if_failed(try_run(value));
+  return value;
+}
+
+Error_Code Bytecode::try_run(long double& value) const noexcept
+{
+  switch (type)
+    {
+    case Number_Type::float_type:
+      return try_run_initial<float>(value);
+    case Number_Type::double_type:
+      return try_run_initial<double>(value);
+    case Number_Type::long_double_type:
+      break;
+    }
+  return try_run_initial<long double>(value);
+}
+
+Error_Code Bytecode::try_run(long double* environment, long double& value) const noexcept
+{
+  return try_run_in(environment, value);
+}
+
+Error_Code Bytecode::try_run(double* environment, double& value) const noexcept
+{
+  return try_run_in(environment, value);
+}
+
+Error_Code Bytecode::try_run(float* environment, float& value) const noexcept
+{
+  return try_run_in(environment, value);
+}
+
+template<typename T>
+Error_Code Bytecode::try_run_initial(long double& value) const noexcept
+{
+  // Miljön kopieras så att uttryckets egna värden aldrig ändras av en
+  // utvärdering; små miljöer får plats på programstacken.
+  constexpr std::size_t local_size{16};
+  const vector<long double>& initial{symbol_table.initial_values()};
+  T                          result{};
+  Error_Code                 error{};
+
+  if (initial.size() <= local_size)
+    {
+      T environment[local_size];
+      copy(initial.begin(), initial.end(), environment);
+      error = try_run_in(environment, result);
+    }
+  else
+    {
+      try
+        {
+          vector<T> environment(initial.begin(), initial.end());
+          error = try_run_in(environment.data(), result);
+        }
+      catch (...)
+        {
+          return Error_Code::out_of_memory;
+        }
+    }
+
+  if (error == Error_Code::none)
+    {
+      value = result;
+    }
+  return error;
+}
+
+long double Bytecode::run(long double* environment) const
+{
+  return run_in(environment);
+}
+
+double Bytecode::run(double* environment) const
+{
+  return run_in(environment);
+}
+
+float Bytecode::run(float* environment) const
+{
+  return run_in(environment);
+}
+
+template<typename T>
+T Bytecode::run_in(T* environment) const
+{
+  if (code.empty())
+    {
+      throw expression_tree_error {"no expression tree"};
+    }
+
+  T value{};
+  throw_if_failed(try_run_in(environment, value));
+  return value;
+}
+
+template<typename T>
+Error_Code Bytecode::try_run_in(T* environment, T& value) const noexcept
+{
+  if (code.empty())
+    {
+      return Error_Code::no_expression;
+    }
+
+  // De flesta uttryck får plats i en stack på programstacken.
+  constexpr std::size_t local_size{64};
+  if (scratch_size() <= local_size)
+    {
+      T stack[local_size];
+      return execute_instructions(code.data(), code.size(), constants_in<T>(),
+                                  stack, stack + max_depth, environment, value);
+    }
+
+  try
+    {
+      vector<T> stack(scratch_size());
+      return execute_instructions(code.data(), code.size(), constants_in<T>(),
+                                  stack.data(), stack.data() + max_depth, environment, value);
+    }
+  catch (...)
+    {
+      return Error_Code::out_of_memory;
+    }
+}
+
+template<typename T>
+const T* Bytecode::constants_in() const
+{
+  if constexpr (is_same_v<T, float>)
+    {
+      return float_constants.data();
+    }
+  else if constexpr (is_same_v<T, double>)
+    {
+      return double_constants.data();
+    }
+  else
+    {
+      return constants.data();
+    }
+}
+
+long double Bytecode::run(Evaluation_Context& context) const
+{
+  if (code.empty())
+    {
+      throw expression_tree_error {"no expression tree"};
+    }
+
+  if (context.values.size() < symbol_table.size())
+    {
+      throw expression_tree_error {"environment too small"};
+    }
+
+  if (context.stack.size() < scratch_size())
+    {
+      context.stack.resize(scratch_size());
+    }
+  long double* stack{context.stack.data()};
+  long double  value{};
+  throw_if_failed(execute_instructions(code.data(), code.size(), constants.data(),
+                                       stack, stack + max_depth, context.values.data(), value));
+  return value;
+}
+
+template<typename T>
+Error_Code execute_instructions(const Instruction* code, std::size_t count, const T* constants,
+                                T* stack, T* temporary, T* environment, T& result) noexcept
+{
+  std::size_t top{0};
+  EXPRESSION_ONLY(std::uint64_t operations[instrumentation::opcode_count]{};)
+
+  for (const Instruction* instruction{code}; instruction != code + count; ++instruction)
+    {
+      EXPRESSION_ONLY(++operations[static_cast<std::size_t>(instruction->op)];)
+      switch (instruction->op)
+        {
+        case Opcode::push_constant:
+          stack[top++] = constants[instruction->arg];
+          break;
+        case Opcode::load_variable:
+          stack[top++] = environment[instruction->arg];
+          break;
+        case Opcode::store_variable:
+          environment[instruction->arg] = stack[top - 1];
+          break;
+        case Opcode::add:
+          --top;
+          stack[top - 1] += stack[top];
+          break;
+        case Opcode::subtract:
+          --top;
+          stack[top - 1] -= stack[top];
+          break;
+        case Opcode::multiply:
+          --top;
+          stack[top - 1] *= stack[top];
+          break;
+        case Opcode::divide:
+          --top;
+          if (stack[top] == 0)
+            {
+              EXPRESSION_ONLY(instrumentation::add_operations(operations);)
+              return Error_Code::division_by_zero;
+            }
+          stack[top - 1] /= stack[top];
+          break;
+        case Opcode::power:
+          --top;
+          stack[top - 1] = pow(stack[top - 1], stack[top]);
+          break;
+        case Opcode::save_temporary:
+          temporary[instruction->arg] = stack[top - 1];
+          break;
+        case Opcode::load_temporary:
+          stack[top++] = temporary[instruction->arg];
+          break;
+        }
+    }
+
+  EXPRESSION_ONLY(instrumentation::add_operations(operations);)
+  result = stack[0];
+  return Error_Code::none;
+}
+
+template Error_Code execute_instructions(const Instruction*, std::size_t, const float*,
+                                         float*, float*, float*, float&) noexcept;
+template Error_Code execute_instructions(const Instruction*, std::size_t, const double*,
+                                         double*, double*, double*, double&) noexcept;
+template Error_Code execute_instructions(const Instruction*, std::size_t, const long double*,
+                                         long double*, long double*, long double*,
+                                         long double&) noexcept;
+
+/*
+ * Parallel_Plan: Ett stort program uppdelat för run(..., Thread_Pool&).
+ * Delarna är delträd som bara läser temporära register de själva sparar
+ * och inte tilldelar någon variabel; de räknas samtidigt och deras värden
+ * sparas i extra temporära register. Därefter räknar resten av programmet,
+ * där varje del ersatts av en läsning av sitt register, ihop värdena i
+ * samma ordning som run(). Varje operation får alltså samma operander och
+ * resultatet blir detsamma bit för bit.
+ */
+struct Bytecode::Parallel_Plan
+{
+  struct Piece
+  {
+    std::uint32_t begin;    // instruktionerna [begin, end)
+    std::uint32_t end;
+  };
+
+  std::vector<Piece>       pieces;         // i programordning, del k i register
+                                           // temporary_count + k
+  std::vector<std::size_t> task_begin;     // första delen per uppgift, plus slutet
+  std::vector<Instruction> residual;
+  std::size_t              residual_depth{0};
+  std::size_t              piece_depth{0};    // största stackdjup inom en del
+};
+
+void Bytecode::plan_parallel()
+{
+  parallel_plan.reset();
+  const std::size_t count{code.size()};
+  if (count < 2 * parallel_grain || count >= UINT32_MAX)
+    {
+      return;
+    }
+
+  // Första svepet: var varje delträd börjar och om det är oberoende. Ett
+  // delträd läser bara egna register om det första register det läser
+  // sparats inom delträdet.
+  constexpr std::uint32_t none{UINT32_MAX};
+  struct Node
+  {
+    std::uint32_t begin;
+    std::uint32_t first_saved;    // där första lästa registret sparades
+    bool          stores;
+  };
+  vector<std::uint32_t> begin(count);
+  vector<bool>          independent(count);
+  vector<std::uint32_t> saved_at(temporary_count, none);
+  vector<Node>          stack;
+  std::size_t           first_store{count};
+  stack.reserve(max_depth);
+
+  for (std::uint32_t i{0}; i < count; ++i)
+    {
+      const Instruction& instruction{code[i]};
+      switch (instruction.op)
+        {
+        case Opcode::push_constant:
+        case Opcode::load_variable:
+          stack.push_back(Node{i, none, false});
+          break;
+        case Opcode::load_temporary:
+          stack.push_back(Node{i, saved_at[instruction.arg], false});
+          break;
+        case Opcode::save_temporary:
+          saved_at[instruction.arg] = i;
+          break;
+        case Opcode::store_variable:
+          stack.back().stores = true;
+          first_store = min<std::size_t>(first_store, i);
+          break;
+        default:
+          {
+            Node right{stack.back()};
+            stack.pop_back();
+            Node& left{stack.back()};
+            left.first_saved = min(left.first_saved, right.first_saved);
+            left.stores = left.stores || right.stores;
+          }
+        }
+      const Node& node{stack.back()};
+      begin[i] = node.begin;
+      independent[i] = !node.stores && node.first_saved >= node.begin;
+    }
+
+  // Delar är små oberoende barn till stora noder. En del efter en
+  // tilldelning kunde läsa variabeln före tilldelningen och tas inte med.
+  auto size = [&begin](std::size_t end) { return end - begin[end] + 1; };
+  vector<bool> piece_end(count);
+  auto consider = [&](std::size_t end)
+  {
+    if (size(end) < parallel_grain && size(end) > 1 && independent[end] && end < first_store)
+      {
+        piece_end[end] = true;
+      }
+  };
+
+  for (std::size_t i{0}; i < count; ++i)
+    {
+      if (size(i) < parallel_grain)
+        {
+          continue;
+        }
+      switch (code[i].op)
+        {
+        case Opcode::save_temporary:
+        case Opcode::store_variable:
+          consider(i - 1);
+          break;
+        case Opcode::add:
+        case Opcode::subtract:
+        case Opcode::multiply:
+        case Opcode::divide:
+        case Opcode::power:
+          consider(i - 1);
+          consider(begin[i - 1] - 1);
+          break;
+        default:
+          break;
+        }
+    }
+
+  auto        plan = make_shared<Parallel_Plan>();
+  std::size_t offloaded{0};
+  for (std::size_t i{0}; i < count; ++i)
+    {
+      if (piece_end[i])
+        {
+          plan->pieces.push_back(Parallel_Plan::Piece{begin[i], static_cast<std::uint32_t>(i + 1)});
+          offloaded += size(i);
+          std::size_t depth{0};
+          for (std::size_t j{begin[i]}; j <= i; ++j)
+            {
+              depth += stack_effect(code[j].op);
+              plan->piece_depth = max(plan->piece_depth, depth);
+            }
+        }
+    }
+
+  // Delarna grupperas i ordning till uppgifter om minst parallel_grain
+  // instruktioner. Utan minst två uppgifter, eller om det mesta av
+  // programmet ändå blir kvar, lönar sig ingen plan.
+  std::size_t task_size{0};
+  for (std::size_t k{0}; k < plan->pieces.size(); ++k)
+    {
+      if (task_size == 0)
+        {
+          plan->task_begin.push_back(k);
+        }
+      task_size += plan->pieces[k].end - plan->pieces[k].begin;
+      if (task_size >= parallel_grain)
+        {
+          task_size = 0;
+        }
+    }
+  plan->task_begin.push_back(plan->pieces.size());
+  if (plan->task_begin.size() < 3 || offloaded < count / 2)
+    {
+      return;
+    }
+
+  std::size_t depth{0};
+  std::size_t k{0};
+  plan->residual.reserve(count - offloaded + plan->pieces.size());
+  for (std::size_t i{0}; i < count; ++i)
+    {
+      if (k < plan->pieces.size() && i == plan->pieces[k].begin)
+        {
+          plan->residual.push_back(Instruction{Opcode::load_temporary,
+                                               static_cast<std::uint32_t>(temporary_count + k)});
+          i = plan->pieces[k].end - 1;
+          ++k;
+          ++depth;
+        }
+      else
+        {
+          plan->residual.push_back(code[i]);
+          depth += stack_effect(code[i].op);
+        }
+      plan->residual_depth = max(plan->residual_depth, depth);
+    }
+
+  parallel_plan = std::move(plan);
+}
+
+long double Bytecode::run(Thread_Pool& pool) const
+{
+  // Som run(): i programmets taltyp, med en kopia av symboltabellens värden.
+  auto run_copy = [this, &pool](auto zero) -> long double
+  {
+    const vector<long double>& initial{symbol_table.initial_values()};
+    vector<decltype(zero)>     environment(initial.begin(), initial.end());
+    return run_parallel(environment.data(), pool);
+  };
+
+  switch (type)
+    {
+    case Number_Type::float_type:
+      return run_copy(0.0f);
+    case Number_Type::double_type:
+      return run_copy(0.0);
+    case Number_Type::long_double_type:
+      break;
+    }
+  return run_copy(0.0L);
+}
+
+long double Bytecode::run(long double* environment, Thread_Pool& pool) const
+{
+  return run_parallel(environment, pool);
+}
+
+double Bytecode::run(double* environment, Thread_Pool& pool) const
+{
+  return run_parallel(environment, pool);
+}
+
+float Bytecode::run(float* environment, Thread_Pool& pool) const
+{
+  return run_parallel(environment, pool);
+}
+
+template<typename T>
+T Bytecode::run_parallel(T* environment, Thread_Pool& pool) const
+{
+  if (code.empty())
+    {
+      throw expression_tree_error {"no expression tree"};
+    }
+
+  T value{};
+  throw_if_failed(try_run_parallel(environment, value, pool));
+  return value;
+}
+
+template<typename T>
+Error_Code Bytecode::try_run_parallel(T* environment, T& value, Thread_Pool& pool) const
+{
+  const Parallel_Plan* plan{parallel_plan.get()};
+  if (plan == nullptr || pool.size() < 2)
+    {
+      return try_run_in(environment, value);
+    }
+
+  const std::size_t  task_count{plan->task_begin.size() - 1};
+  const T*           values{constants_in<T>()};
+  vector<T>          registers(temporary_count + plan->pieces.size());
+  vector<Error_Code> errors(task_count);
+
+  // Delarna sparar bara i sina egna register och läser inget som en annan
+  // del skriver, så uppgifterna kan dela registren. En dels stack är högst
+  // lika djup som delen är lång, aldrig hela programmets djup.
+  pool.run(task_count, [&](std::size_t task)
+  {
+    vector<T> stack(plan->piece_depth);
+    for (std::size_t k{plan->task_begin[task]}; k < plan->task_begin[task + 1]; ++k)
+      {
+        const Parallel_Plan::Piece& piece{plan->pieces[k]};
+        Error_Code error{execute_instructions(code.data() + piece.begin, piece.end - piece.begin,
+                                              values, stack.data(), registers.data(), environment,
+                                              registers[temporary_count + k])};
+        if (error != Error_Code::none)
+          {
+            errors[task] = error;
+            return;
+          }
+      }
+  });
+
+  for (Error_Code error : errors)
+    {
+      if (error != Error_Code::none)
+        {
+          return error;
+        }
+    }
+
+  vector<T> stack(plan->residual_depth);
+  return execute_instructions(plan->residual.data(), plan->residual.size(), values,
+                              stack.data(), registers.data(), environment, value);
+}
+
+long double Bytecode::run_gradient(long double* environment, long double* gradient) const
+{
+  if (code.empty())
+    {
+      throw expression_tree_error {"no expression tree"};
+    }
+
+  // Framåtsvepet sparar varje beräknat värde på ett band tillsammans med
+  // operandernas platser på bandet; stacken och de temporära registren
+  // innehåller platser i stället för värden. En läsning av en variabel som
+  // ännu inte tilldelats blir en egen post, medan en läsning efter en
+  // tilldelning pekar på posten för det tilldelade värdet.
+  struct Step
+  {
+    Opcode        op;
+    std::uint32_t left;    // variabelns plats för load_variable
+    std::uint32_t right;
+    long double   value;
+  };
+  constexpr std::uint32_t no_step{UINT32_MAX};
+
+  vector<Step>          tape;
+  vector<std::uint32_t> stack(max_depth);
+  vector<std::uint32_t> temporary(temporary_count);
+  vector<std::uint32_t> definition(symbol_table.size(), no_step);
+  std::size_t           top{0};
+  tape.reserve(code.size());
+
+  auto record = [&tape](Opcode op, std::uint32_t left, std::uint32_t right, long double value)
+  {
+    tape.push_back(Step{op, left, right, value});
+    return static_cast<std::uint32_t>(tape.size() - 1);
+  };
+
+  for (const Instruction& instruction : code)
+    {
+      switch (instruction.op)
+        {
+        case Opcode::push_constant:
+          stack[top++] = record(Opcode::push_constant, 0, 0, constants[instruction.arg]);
+          break;
+        case Opcode::load_variable:
+          if (definition[instruction.arg] == no_step)
+            {
+              definition[instruction.arg] = record(Opcode::load_variable, instruction.arg, 0,
+                                                   environment[instruction.arg]);
+            }
+          stack[top++] = definition[instruction.arg];
+          break;
+        case Opcode::store_variable:
+          definition[instruction.arg] = stack[top - 1];
+          environment[instruction.arg] = tape[stack[top - 1]].value;
+          break;
+        case Opcode::save_temporary:
+          temporary[instruction.arg] = stack[top - 1];
+          break;
+        case Opcode::load_temporary:
+          stack[top++] = temporary[instruction.arg];
+          break;
+        default:
+          {
+            --top;
+            long double left{tape[stack[top - 1]].value};
+            long double right{tape[stack[top]].value};
+            long double value{};
+            switch (instruction.op)
+              {
+              case Opcode::add:      value = left + right; break;
+              case Opcode::subtract: value = left - right; break;
+              case Opcode::multiply: value = left * right; break;
+              case Opcode::divide:
+                if (right == 0)
+                  {
+                    throw expression_tree_error {"do not divide by zero"};
+                  }
+                value = left / right;
+                break;
+              default:               value = pow(left, right); break;
+              }
+            stack[top - 1] = record(instruction.op, stack[top - 1], stack[top], value);
+          }
+          break;
+        }
+    }
+
+  // Bakåtsvepet: varje posts derivata (adjoint) fördelas på operanderna i
+  // omvänd ordning, så att en post är klar innan den används. Derivatan
+  // för en oinitierad läsning är derivatan för variabeln.
+  fill(gradient, gradient + symbol_table.size(), 0.0L);
+  vector<long double> adjoint(tape.size(), 0.0L);
+  adjoint[stack[0]] = 1;
+
+  for (std::size_t i{tape.size()}; i-- > 0;)
+    {
+      const Step& step{tape[i]};
+      long double d{adjoint[i]};
+      if (d == 0)
+        {
+          continue;
+        }
+
+      switch (step.op)
+        {
+        case Opcode::load_variable:
+          gradient[step.left] += d;
+          break;
+        case Opcode::add:
+          adjoint[step.left] += d;
+          adjoint[step.right] += d;
+          break;
+        case Opcode::subtract:
+          adjoint[step.left] += d;
+          adjoint[step.right] -= d;
+          break;
+        case Opcode::multiply:
+          adjoint[step.left] += d * tape[step.right].value;
+          adjoint[step.right] += d * tape[step.left].value;
+          break;
+        case Opcode::divide:
+          adjoint[step.left] += d / tape[step.right].value;
+          adjoint[step.right] -= d * step.value / tape[step.right].value;
+          break;
+        case Opcode::power:
+          {
+            // a^b: derivatan med avseende på b finns bara för a > 0, och
+            // räknas som 0 annars (t.ex. för heltalsexponenter av negativa tal).
+            // För b = 0 är a^b konstant i a; 0 * pow(0, -1) skulle ge NaN.
+            long double a{tape[step.left].value};
+            long double b{tape[step.right].value};
+            if (b != 0)
+              {
+                adjoint[step.left] += d * b * pow(a, b - 1);
+              }
+            if (a > 0)
+              {
+                adjoint[step.right] += d * step.value * log(a);
+              }
+          }
+          break;
+        default:
+          break;
+        }
+    }
+
+  return tape[stack[0]].value;
+}
+
+void Bytecode::run_batch(const Column_Map& columns, double* result, std::size_t rows) const
+{
+  if (code.empty())
+    {
+      throw expression_tree_error {"no expression tree"};
+    }
+
+  // Variabler utan kolumn får bara läsas efter att de tilldelats.
+  vector<const double*> slot_columns(symbol_table.size(), nullptr);
+  for (std::size_t slot{0}; slot < symbol_table.size(); ++slot)
+    {
+      auto column = columns.find(symbol_table.name(slot));
+      if (column != columns.end())
+        {
+          slot_columns[slot] = column->second;
+        }
+    }
+
+  vector<double> stack(scratch_size() * block_size);
+  vector<double> assigned(symbol_table.size() * block_size);
+  for (std::size_t first{0}; first < rows; first += block_size)
+    {
+      execute_block(slot_columns, stack.data(), assigned.data(), result,
+                    first, min(block_size, rows - first));
+    }
+}
+
+void Bytecode::execute_block(const vector<const double*>& columns, double* stack,
+                             double* assigned, double* result,
+                             std::size_t first, std::size_t count) const
+{
+  // Stacken består av ett block per nivå; top pekar på blocket efter toppen.
+  // Varje variabel läses ur sin kolumn tills den tilldelats i blocket, därefter
+  // ur sitt block i assigned.
+  double* top{stack};
+  double* temporary{stack + max_depth * block_size};
+  vector<const double*> sources(columns.size());
+  for (std::size_t slot{0}; slot < columns.size(); ++slot)
+    {
+      sources[slot] = columns[slot] != nullptr ? columns[slot] + first : nullptr;
+    }
+
+  for (const Instruction& instruction : code)
+    {
+      switch (instruction.op)
+        {
+        case Opcode::push_constant:
+          fill_block(top, static_cast<double>(constants[instruction.arg]));
+          top += block_size;
+          break;
+        case Opcode::load_variable:
+          if (sources[instruction.arg] == nullptr)
+            {
+              throw expression_tree_error {"no column for variable " +
+                                           symbol_table.name(instruction.arg)};
+            }
+          copy_n(sources[instruction.arg], count, top);
+          fill_n(top + count, block_size - count, 1.0);
+          top += block_size;
+          break;
+        case Opcode::store_variable:
+          {
+            double* block{assigned + instruction.arg * block_size};
+            copy_n(top - block_size, block_size, block);
+            sources[instruction.arg] = block;
+          }
+          break;
+        case Opcode::add:
+          top -= block_size;
+          add_block(top - block_size, top);
+          break;
+        case Opcode::subtract:
+          top -= block_size;
+          subtract_block(top - block_size, top);
+          break;
+        case Opcode::multiply:
+          top -= block_size;
+          multiply_block(top - block_size, top);
+          break;
+        case Opcode::divide:
+          top -= block_size;
+          if (find(top, top + count, 0.0) != top + count)
+            {
+              throw expression_tree_error {"do not divide by zero"};
+            }
+          divide_block(top - block_size, top);
+          break;
+        case Opcode::power:
+          top -= block_size;
+          power_block(top - block_size, top);
+          break;
+        case Opcode::save_temporary:
+          copy_n(top - block_size, block_size, temporary + instruction.arg * block_size);
+          break;
+        case Opcode::load_temporary:
+          copy_n(temporary + instruction.arg * block_size, block_size, top);
+          top += block_size;
+          break;
+        }
+    }
+
+  copy_n(stack, count, result + first);
+}
+
+const Symbol_Table& Bytecode::symbols() const
+{
+  return symbol_table;
+}
+
+Symbol_Table& Bytecode::symbols()
+{
+  return symbol_table;
+}
+
+std::size_t Bytecode::memory_size() const
+{
+  // Per variabel: namnet, värdet och en nod i symboltabellens map.
+  constexpr std::size_t map_node_overhead{48};
+  std::size_t size{sizeof(Bytecode) + code.capacity() * sizeof(Instruction) +
+                   constants.capacity() * sizeof(long double) +
+                   double_constants.capacity() * sizeof(double) +
+                   float_constants.capacity() * sizeof(float) +
+                   temporaries.size() * (sizeof(void*) + 2 * sizeof(std::size_t))};
+  if (parallel_plan != nullptr)
+    {
+      size += sizeof(Parallel_Plan) +
+        parallel_plan->pieces.capacity() * sizeof(Parallel_Plan::Piece) +
+        parallel_plan->task_begin.capacity() * sizeof(std::size_t) +
+        parallel_plan->residual.capacity() * sizeof(Instruction);
+    }
+  for (std::size_t slot{0}; slot < symbol_table.size(); ++slot)
+    {
+      size += 2 * sizeof(std::string) + symbol_table.name(slot).capacity() +
+        sizeof(long double) + map_node_overhead;
+    }
+  return size;
+}
+
+Number_Type Bytecode::number_type() const
+{
+  return type;
+}
+
+void Bytecode::set_number_type(Number_Type number_type)
+{
+  type = number_type;
+}
+
+bool Bytecode::empty() const
+{
+  return code.empty();
+}
+
+void Bytecode::swap(Bytecode& other) noexcept
+{
+  std::swap(code, other.code);
+  std::swap(constants, other.constants);
+  std::swap(double_constants, other.double_constants);
+  std::swap(float_constants, other.float_constants);
+  symbol_table.swap(other.symbol_table);
+  std::swap(depth, other.depth);
+  std::swap(max_depth, other.max_depth);
+  std::swap(temporary_count, other.temporary_count);
+  std::swap(type, other.type);
+  std::swap(temporaries, other.temporaries);
+  std::swap(parallel_plan, other.parallel_plan);
+}
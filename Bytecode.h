@@ -0,0 +1,188 @@
+/*
+ * Bytecode.h
+ */
+#ifndef BYTECODE_H
+#define BYTECODE_H
+#include "Expression_Status.h"
+#include "Symbol_Table.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class Expression_Tree;
+class Thread_Pool;
+
+/**
+ * Column_Map: Indata för satsvis utvärdering, en kolumn med värden per
+ * variabelnamn (struct of arrays).
+ */
+using Column_Map = std::map<std::string, const double*, std::less<>>;
+
+enum class Opcode : std::uint8_t
+{
+  push_constant,
+  load_variable,
+  store_variable,
+  add,
+  subtract,
+  multiply,
+  divide,
+  power,
+  save_temporary,
+  load_temporary
+};
+
+struct Instruction
+{
+  Opcode        op;
+  std::uint32_t arg;
+};
+
+/**
+ * Number_Type: Typen som stackmaskinen räknar i. long double är mest
+ * noggrann; double och float kan räknas med SSE och är snabbare.
+ */
+enum class Number_Type : std::uint8_t
+{
+  float_type,
+  double_type,
+  long_double_type
+};
+
+/**
+ * execute_instructions: Stackmaskinen, gemensam för Bytecode och program
+ * som läses direkt ur en Expression_Image, för T = float, double eller
+ * long double. stack ska rymma programmets största djup och temporary dess
+ * temporära register. Värdet skrivs till result; ett fel ges som felkod.
+ */
+template<typename T>
+Error_Code execute_instructions(const Instruction* code, std::size_t count, const T* constants,
+                                T* stack, T* temporary, T* environment, T& result) noexcept;
+
+/**
+ * Evaluation_Context: Tillståndet för en utvärdering, dvs. miljön med ett
+ * värde per variabelplats samt en stack som återanvänds mellan anropen.
+ * Ett och samma Bytecode-objekt kan utvärderas samtidigt från flera trådar
+ * så länge varje tråd har en egen kontext.
+ */
+class Evaluation_Context
+{
+public:
+  Evaluation_Context() = default;
+  explicit Evaluation_Context(std::vector<long double> values) : values{std::move(values)} {}
+
+  long double&       operator[](std::size_t slot)       { return values[slot]; }
+  const long double& operator[](std::size_t slot) const { return values[slot]; }
+
+  long double* environment() { return values.data(); }
+  std::size_t  size() const  { return values.size(); }
+
+private:
+  friend class Bytecode;
+
+  std::vector<long double> values;
+  std::vector<long double> stack;
+};
+
+/**
+ * Bytecode: Ett uttrycksträd sänkt till en platt instruktionsföljd i
+ * postfixordning. Instruktionerna utförs av en stackmaskin i run().
+ * Variabler läses från och skrivs till en miljö, en array med ett värde
+ * per plats i symboltabellen.
+ */
+class Bytecode
+{
+public:
+  void emit_constant(long double value);
+  void emit_load(std::string_view name, long double initial_value = 0);
+  void emit_store(std::string_view name);
+  void emit(Opcode op);
+
+  // Delade delträd beräknas en gång och sparas i ett temporärt register;
+  // recall() lägger ut en läsning av registret om noden redan beräknats.
+  bool recall(const Expression_Tree* node);
+  void remember(const Expression_Tree* node);
+
+  // run() räknar i programmets taltyp (set_number_type) med en kopia av
+  // symboltabellens värden; övriga räknar i miljöns typ.
+  long double run() const;
+  long double run(long double* environment) const;
+  double      run(double* environment) const;
+  float       run(float* environment) const;
+  long double run(Evaluation_Context& context) const;
+  // Som run() men utan undantag; value ändras bara om felkoden är none.
+  Error_Code  try_run(long double& value) const noexcept;
+  Error_Code  try_run(long double* environment, long double& value) const noexcept;
+  Error_Code  try_run(double* environment, double& value) const noexcept;
+  Error_Code  try_run(float* environment, float& value) const noexcept;
+  // Som run() men med ett stort program uppdelat på poolens trådar enligt
+  // plan_parallel(); resultatet är detsamma bit för bit. Program utan plan
+  // räknas direkt på den anropande tråden.
+  long double run(Thread_Pool& pool) const;
+  long double run(long double* environment, Thread_Pool& pool) const;
+  double      run(double* environment, Thread_Pool& pool) const;
+  float       run(float* environment, Thread_Pool& pool) const;
+  // Värdet och derivatan med avseende på varje variabelplats, med ett
+  // framåt- och ett bakåtsvep över programmet (reverse mode).
+  long double run_gradient(long double* environment, long double* gradient) const;
+  void        run_batch(const Column_Map& columns, double* result, std::size_t rows) const;
+  // Anropas när programmet är färdigt. Ett program med minst två gånger
+  // parallel_grain instruktioner delas i oberoende delträd som kan räknas
+  // samtidigt; mindre program får ingen plan.
+  static constexpr std::size_t parallel_grain{4096};   // instruktioner per uppgift
+  void        plan_parallel();
+  bool        empty() const;
+  void        swap(Bytecode&) noexcept;
+  Number_Type number_type() const;
+  void        set_number_type(Number_Type type);
+  // Ungefärligt minnesbehov i byte, inklusive symboltabellen.
+  std::size_t memory_size() const;
+
+  const Symbol_Table& symbols() const;
+  Symbol_Table&       symbols();
+
+private:
+  friend class Incremental_Evaluation;
+  friend class Native_Function;
+  friend class Expression_Image_Writer;
+  friend class Expression_Program;
+
+  struct Parallel_Plan;
+
+  std::size_t scratch_size() const;
+  template<typename T> T run_in(T* environment) const;
+  template<typename T> T run_parallel(T* environment, Thread_Pool& pool) const;
+  template<typename T> Error_Code try_run_parallel(T* environment, T& value,
+                                                   Thread_Pool& pool) const;
+  template<typename T> Error_Code try_run_in(T* environment, T& value) const noexcept;
+  template<typename T> Error_Code try_run_initial(long double& value) const noexcept;
+  template<typename T> const T* constants_in() const;
+  void        execute_block(const std::vector<const double*>& columns, double* stack,
+                            double* assigned, double* result,
+                            std::size_t first, std::size_t count) const;
+  void        push_instruction(Opcode op, std::size_t arg, int stack_effect);
+
+  std::vector<Instruction>     code;
+  std::vector<long double>     constants;
+  // Konstanterna avrundade till de mindre taltyperna, en gång för alla.
+  std::vector<double>          double_constants;
+  std::vector<float>           float_constants;
+  Symbol_Table                 symbol_table;
+  std::size_t                  depth{0};
+  std::size_t                  max_depth{0};
+  std::size_t                  temporary_count{0};
+  Number_Type                  type{Number_Type::long_double_type};
+
+  std::unordered_map<const Expression_Tree*, std::size_t> temporaries;
+  // Oföränderlig när den väl byggts och därför delad mellan kopior.
+  std::shared_ptr<const Parallel_Plan>                     parallel_plan;
+};
+
+#endif
@@ -2,44 +2,148 @@
  * Expression.cc
  */
 #include "Expression.h"
+#include "Expression_Grammar.h"
 #include "Expression_Tree.h"
+#include "Instrumentation.h"
+#include "Node_Arena.h"
+#include "Subtree_Table.h"
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <charconv>
 #include <iostream>
 #include <iterator>
-#include <map>
-#include <sstream>
-#include <stack>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 using namespace std;
 
 
-Expression::Expression(Expression_Tree* p) : pointer{p} {}
+namespace
+{
+  /*
+   * Tree_Owner: Trädet och arenan som äger det. Trädet ägs av arenan när en
+   * sådan finns, annars av tree självt.
+   */
+  struct Tree_Owner
+  {
+    Tree_Owner(Node_Arena* a, Expression_Tree* t) noexcept : arena{a}, tree{t} {}
+    ~Tree_Owner() { release(arena, tree); }
+
+    static void release(Node_Arena* arena, Expression_Tree* tree) noexcept
+    {
+      if (arena == nullptr)
+        {
+          delete tree;
+        }
+      delete arena;
+    }
+
+    Node_Arena*      arena;
+    Expression_Tree* tree;
+
+    Tree_Owner(const Tree_Owner&) = delete;
+    Tree_Owner& operator =(const Tree_Owner&) = delete;
+  };
+}
 
-Expression::~Expression() 
+/*
+ * Body: Trädet och det kompilerade programmet. Trädet ändras aldrig när det
+ * väl är byggt och delas därför mellan kopior av kroppen; en kopia, som
+ * set_variable() gör av ett delat uttryck, kopierar bara programmet.
+ */
+struct Expression::Body
 {
-  delete pointer;
-  pointer = nullptr;
+  Body(Node_Arena* a, Expression_Tree* t);
+  Body(const Body& other) = default;
+
+  const Expression_Tree* tree() const { return owner->tree; }
+  const Node_Arena*      arena() const { return owner->arena; }
+
+  std::shared_ptr<const Tree_Owner> owner;
+  Bytecode                          program{};
+
+  Body& operator =(const Body&) = delete;
+};
+
+#ifdef EXPRESSION_INSTRUMENTATION
+namespace
+{
+  // Antal noder och djup för ett nytt uttryck. Delade delträd räknas en
+  // gång per förekomst, som i det ursprungliga trädet.
+  void record_shape(const Expression_Tree* tree)
+  {
+    std::uint64_t nodes{0};
+    std::uint64_t depth{0};
+    vector<pair<const Expression_Tree*, std::uint64_t>> work{{tree, 1}};
+    while (!work.empty())
+      {
+        auto [node, level] = work.back();
+        work.pop_back();
+        ++nodes;
+        depth = max(depth, level);
+        if (auto op = Binary_Operator::as_binary(node))
+          {
+            work.push_back({op->left(), level + 1});
+            work.push_back({op->right(), level + 1});
+          }
+      }
+    instrumentation::add_expression(nodes, depth);
+  }
 }
+#endif
 
-Expression::Expression(Expression&& other)
+Expression::Body::Body(Node_Arena* a, Expression_Tree* t)
 {
-  swap(other);
+  try
+    {
+      owner = make_shared<const Tree_Owner>(a, t);
+    }
+  catch (...)
+    {
+      Tree_Owner::release(a, t);
+      throw;
+    }
+
+  {
+    EXPRESSION_TIME_PHASE(compile);
+    t->compile(program);
+    program.plan_parallel();
+  }
+  EXPRESSION_ONLY(record_shape(t);)
+}
+
+Expression::Expression(Expression_Tree* p)
+{
+  if (p != nullptr)
+    {
+      body = make_shared<Body>(nullptr, p);
+    }
 }
 
-Expression::Expression(const Expression& other)
+Expression::Expression(Node_Arena* a, Expression_Tree* p)
 {
-  if (other.pointer != nullptr)
+  if (p != nullptr)
     {
-      this->pointer = other.pointer->clone();
+      body = make_shared<Body>(a, p);
     }
   else
     {
-      this->pointer = nullptr;
+      delete a;
     }
 }
 
+Expression::~Expression() = default;
+
+Expression::Expression(Expression&& other)
+{
+  swap(other);
+}
+
+Expression::Expression(const Expression& other) : body{other.body} {}
+
 Expression& Expression:: operator = (Expression&& other)
 {
   swap(other);
@@ -48,60 +152,356 @@ Expression& Expression:: operator = (Expression&& other)
 
 Expression& Expression:: operator = (const Expression& other)
 {
-  this->pointer = other.pointer->clone();
+  body = other.body;
   return *this;
 }
 
+Expression::Body& Expression::unshared_body()
+{
+  if (body.use_count() > 1)
+    {
+      body = make_shared<Body>(*body);
+    }
+  else
+    {
+      // use_count() läses utan ordning; staketet ser till att en annan
+      // tråds läsningar, före det att den släppte sin kopia, är klara innan
+      // kroppen ändras här.
+      atomic_thread_fence(memory_order_acquire);
+    }
+  return *body;
+}
+
+const Bytecode& Expression::program() const
+{
+  return body->program;
+}
+
 long double Expression::evaluate() const
 {
-  if (pointer == nullptr)
+  if (body == nullptr)
     {
       throw expression_error {"no expression to evaluate"};  
     }
   else
     {
-      return pointer->evaluate();
+      return body->program.run();
     }
 }
 
 
 
-std::string Expression::get_postfix() const
+long double Expression::evaluate(long double* environment) const
 {
-  if (pointer == nullptr)
+  if (body == nullptr)
     {
-      throw expression_error {"no expression"};
+      throw expression_error {"no expression to evaluate"};  
     }
   else
     {
-      return pointer->get_postfix();
+      return body->program.run(environment);
     }
 }
 
+double Expression::evaluate(double* environment) const
+{
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+  return body->program.run(environment);
+}
 
+float Expression::evaluate(float* environment) const
+{
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+  return body->program.run(environment);
+}
 
-bool Expression::empty() const
+long double Expression::evaluate(Thread_Pool& pool) const
+{
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+  return body->program.run(pool);
+}
+
+long double Expression::evaluate(long double* environment, Thread_Pool& pool) const
+{
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+  return body->program.run(environment, pool);
+}
+
+double Expression::evaluate(double* environment, Thread_Pool& pool) const
+{
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+  return body->program.run(environment, pool);
+}
+
+float Expression::evaluate(float* environment, Thread_Pool& pool) const
 {
-  return (pointer == nullptr);  
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+  return body->program.run(environment, pool);
 }
 
+Number_Type Expression::number_type() const
+{
+  return body != nullptr ? body->program.number_type() : Number_Type::long_double_type;
+}
 
-void Expression::print_tree(std::ostream&) const
+void Expression::set_number_type(Number_Type type)
 {
-  if (pointer == nullptr)
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+  if (type != number_type())
     {
-      throw expression_error {"no expression"};
+      unshared_body().program.set_number_type(type);
+    }
+}
+
+long double Expression::evaluate(Evaluation_Context& context) const
+{
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};  
     }
   else
     {
-      pointer->print(cout);
+      return body->program.run(context);
+    }
+}
+
+Expression_Status Expression::try_evaluate(long double& value) const noexcept
+{
+  if (body == nullptr)
+    {
+      return Expression_Status{Error_Code::no_expression};
+    }
+  return Expression_Status{body->program.try_run(value)};
+}
+
+Expression_Status Expression::try_evaluate(long double* environment,
+                                           long double& value) const noexcept
+{
+  if (body == nullptr)
+    {
+      return Expression_Status{Error_Code::no_expression};
+    }
+  return Expression_Status{body->program.try_run(environment, value)};
+}
+
+Expression_Status Expression::try_evaluate(double* environment, double& value) const noexcept
+{
+  if (body == nullptr)
+    {
+      return Expression_Status{Error_Code::no_expression};
+    }
+  return Expression_Status{body->program.try_run(environment, value)};
+}
+
+Expression_Status Expression::try_evaluate(float* environment, float& value) const noexcept
+{
+  if (body == nullptr)
+    {
+      return Expression_Status{Error_Code::no_expression};
+    }
+  return Expression_Status{body->program.try_run(environment, value)};
+}
+
+long double Expression::evaluate_gradient(long double* environment,
+                                          long double* gradient) const
+{
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+  return body->program.run_gradient(environment, gradient);
+}
+
+long double Expression::evaluate_gradient(std::vector<long double>& gradient) const
+{
+  std::vector<long double> environment{make_environment()};
+  gradient.resize(environment.size());
+  return evaluate_gradient(environment.data(), gradient.data());
+}
+
+Evaluation_Context Expression::make_context() const
+{
+  return Evaluation_Context{make_environment()};
+}
+
+std::size_t Expression::variable_count() const
+{
+  return body != nullptr ? body->program.symbols().size() : 0;
+}
+
+std::size_t Expression::memory_size() const
+{
+  if (body == nullptr)
+    {
+      return 0;
+    }
+  return sizeof(Body) + body->program.memory_size() +
+    (body->arena() != nullptr ? body->arena()->bytes_used() : 0);
+}
+
+std::size_t Expression::find_variable(std::string_view name) const
+{
+  return body != nullptr ? body->program.symbols().slot(name) : Symbol_Table::npos;
+}
+
+std::size_t Expression::variable_slot(std::string_view name) const
+{
+  std::size_t slot{find_variable(name)};
+  if (slot == Symbol_Table::npos)
+    {
+      throw expression_error {"no variable " + std::string{name}};
+    }
+  return slot;
+}
+
+Incremental_Evaluation Expression::make_incremental() const
+{
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+  return Incremental_Evaluation{body->program};
+}
+
+Native_Function Expression::make_native() const
+{
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+
+  // Infixformen får namnge funktionen, i perf-kartan.
+  std::string name;
+  write_infix(name);
+  if (name.size() > 64)
+    {
+      name.resize(61);
+      name += "...";
+    }
+  return Native_Function{body->program, name};
+}
+
+std::vector<long double> Expression::make_environment() const
+{
+  if (body == nullptr)
+    {
+      return {};
+    }
+  return body->program.symbols().initial_values();
+}
+
+void Expression::set_variable(std::string_view name, long double value)
+{
+  std::size_t slot{variable_slot(name)};
+  unshared_body().program.symbols().set_initial_value(slot, value);
+}
+
+
+
+void Expression::evaluate_batch(const Column_Map& columns, double* result,
+                                std::size_t rows) const
+{
+  if (body == nullptr)
+    {
+      throw expression_error {"no expression to evaluate"};  
+    }
+  else
+    {
+      body->program.run_batch(columns, result, rows);
+    }
+}
+
+
+
+std::string Expression::get_postfix() const
+{
+  std::string postfix;
+  write_postfix(postfix);
+  return postfix;
+}
+
+// Ett tomt uttryck skrivs som ingenting.
+void Expression::write_postfix(std::ostream& os) const
+{
+  if (body != nullptr)
+    {
+      body->tree()->write_postfix(os);
+    }
+}
+
+void Expression::write_postfix(std::string& buffer) const
+{
+  if (body != nullptr)
+    {
+      body->tree()->write_postfix(buffer);
+    }
+}
+
+void Expression::write_infix(std::ostream& os) const
+{
+  if (body != nullptr)
+    {
+      body->tree()->write_infix(os);
+    }
+}
+
+void Expression::write_infix(std::string& buffer) const
+{
+  if (body != nullptr)
+    {
+      body->tree()->write_infix(buffer);
+    }
+}
+
+
+
+bool Expression::empty() const
+{
+  return (body == nullptr);  
+}
+
+
+void Expression::print_tree(std::ostream& os) const
+{
+  if (body != nullptr)
+    {
+      body->tree()->write_tree(os);
+    }
+}
+
+void Expression::print_tree(std::string& buffer) const
+{
+  if (body != nullptr)
+    {
+      body->tree()->write_tree(buffer);
     }
 }
 
 
 void Expression::swap(Expression& e2) noexcept
 {
-  std::swap(pointer, e2.pointer);
+  body.swap(e2.body);
 }
 
 
@@ -111,342 +511,445 @@ void swap(Expression& e1, Expression& e2) noexcept
 }
 
 
-Expression make_expression(const string& infix);
+Expression make_expression(std::string_view infix, const Expression_Options& options);
 
-// Namrymden nedan innehller intern kod fr infix-till-postfix-omvandling
-// och generering av uttryckstrd. En anonym namnrymd begrnsar anvndningen
+// Namrymden nedan innehåller intern kod för att tolka ett infixuttryck och
+// generera motsvarande uttrycksträd. En anonym namnrymd begränsar användningen
 // av medlemmarna till denna fil.
 namespace
 {
    using std::vector;
-   using std::map;
-   using std::make_pair;
    using std::string;
+   using std::string_view;
 
-   // Teckenuppsttningar fr operander. Anvnds av make_expression_tree().
-   const string letters{"abcdefghijklmnopqrstuvwxyz"};
-   const string digits{"0123456789"};
-   const string integer_chars{digits};
-   const string real_chars{digits + '.'};
-   const string variable_chars{letters};
-   const string operand_chars{letters + digits + '.'};
-
-   // Tilltna operatorer. Anvnds av make_postfix() och make_expression_tree().
-   // Prioritetstabeller, en fr inkommandeprioritet och en fr stackprioritet. 
-   // Hgre vrde inom input_prio respektive stack_prio anger inbrdes prioritetsordning.
-   // Hgre vrde i input_prio jmfrt med motsvarande position i stack_prio innebr
-   // hgerassociativitet, det motsatta vnsterassociativitet. Anvnds av make_postfix(). 
-   using priority_table = map<string, int>;
-
-   const vector<string> operators{ "^", "*", "/", "+", "-", "=" };
-   const priority_table input_priority{ {"^", 8}, {"*", 5}, {"/", 5}, {"+", 3}, {"-", 3}, {"=", 2} };
-   const priority_table stack_priority{ {"^", 7}, {"*", 6}, {"/", 6}, {"+", 4}, {"-", 4}, {"=", 1} };
-
-   // Hjlpfunktioner fr att kategorisera lexikala element.
-   bool is_operator(char token)
-   {
-      return find(begin(operators), end(operators), string{token}) != end(operators);
-   }
-
-   bool is_operator(const string& token)
-   {
-      return find(begin(operators), end(operators), token) != end(operators);
-   }
-
-   bool is_operand(const string& token)
-   {
-      return token.find_first_not_of(operand_chars) == string::npos;
-   }
+   using expression_grammar::character_class;
+   using expression_grammar::input_priority;
+   using expression_grammar::is_operand_char;
+   using expression_grammar::stack_priority;
 
-   bool is_integer(const string& token)
+   // Stack med plats för de första Capacity elementen i objektet självt;
+   // först djupare nästling lägger resten på heapen.
+   template<typename T, std::size_t Capacity>
+   class Small_Stack
    {
-      return token.find_first_not_of(integer_chars) == string::npos;
-   }
+   public:
+      bool empty() const { return count == 0; }
 
-   bool is_real(const string& token)
-   {
-      return token.find_first_not_of(real_chars) == string::npos;
-   }
-
-   bool is_identifier(const string& token)
-   {
-      return token.find_first_not_of(letters) == string::npos;
-   }
-
-   // format_infix tar en strng med ett infixuttryck och formaterar med ett
-   // mellanrum mellan varje symbol; underlttar vid bearbetningen i make_postfix.
-   std::string format_infix(const std::string& infix)
-   {
-      auto bos = begin(infix);
-      auto eos = end(infix);
-      string formated;
+      T& back()
+      {
+	 return count <= Capacity ? fixed[count - 1] : overflow.back();
+      }
 
-      for (auto it = bos; it != eos; ++it)
+      void push_back(const T& value)
       {
-	 if (is_operator(*it) || *it == '(' || *it == ')')
+	 if (count < Capacity)
 	 {
-	    // Se till att det r ett mellanrum fre en operator eller parentes
-	    if (it != bos && *(it - 1) != ' ' && *(formated.end() - 1) != ' ')
-	       formated.append(1, ' ');
-	    formated.append(1, *it);
-	    // Se till att det r ett mellanrum efter en operator eller parentes
-	    if ((it + 1) != eos && *(it + 1) != ' ')
-	       formated.append(1, ' ');
+	    fixed[count] = value;
 	 }
 	 else
 	 {
-	    if (*it != ' ')
-	       formated.append(1, *it);
-	    else if (it != bos && *(it - 1) != ' ')
-	       formated.append(1, *it);
+	    overflow.push_back(value);
 	 }
+	 ++count;
       }
-      return formated;
-   }
 
-   // make_postfix tar en infixstrng och returnerar motsvarande postfixstrng.
-   std::string make_postfix(const std::string& infix)
-   {
-      using std::stack;
-      using std::string;
-      using std::istringstream;
-      using std::find;
-
-      stack<string> operator_stack;
-      string        token;
-      string        previous_token;
-      bool          last_was_operand{false};
-      bool          assignment{false};
-      int           paren_count{0};
-
-      istringstream is{format_infix(infix)};
-      string        postfix;
-
-      while (is >> token)
+      void pop_back()
       {
-	 if (is_operator(token))
+	 if (count > Capacity)
 	 {
-	    if (!last_was_operand || postfix.empty() || previous_token == "(")
-	    {
-	      throw expression_error {"operator dr operand frvntades\n"};
-	    }
+	    overflow.pop_back();
+	 }
+	 --count;
+      }
 
-	    if (token == "=")
-	    {
-	       if (assignment)
-	       {
-		 throw expression_error {"multipel tilldelning"};
-	       }
-	       else
-	       {
-		  assignment = true;
-	       }
-	    }
+   private:
+      T              fixed[Capacity]{};
+      vector<T>      overflow;
+      std::size_t    count{0};
+   };
+
+   // Parser läser ett infixuttryck i ett svep och bygger trädet direkt, med
+   // precedensklättring över samma prioritetstabeller som postfixomvandlingen
+   // tidigare använde: en operator binder sin vänstra operand så länge dess
+   // inkommandeprioritet är högre än stackprioriteten hos operatorn till
+   // vänster om operanden.
+   //
+   // Fel i texten kastar inga undantag: parse() ger då nullptr och status()
+   // felkoden och positionen, så att en felaktig rad kostar lika lite som
+   // en korrekt. Bara minnesbrist kastar.
+   class Parser
+   {
+   public:
+      Parser(string_view infix, Node_Arena& arena) : input{infix}, arena{arena}
+      {
+	 advance();
+      }
 
-	    while (!operator_stack.empty() && operator_stack.top() != "(" &&
-		   input_priority.find(token)->second <=
-		   stack_priority.find(operator_stack.top())->second)
-	    {
-	       postfix += operator_stack.top() + ' ';
-	       operator_stack.pop();
-	    }
-	    operator_stack.push(token);
-	    last_was_operand = false;
-	 }
-	 else if (token == "(")
+      Expression_Tree* parse()
+      {
+	 if (current.kind == Token_Kind::end)
 	 {
-	    operator_stack.push(token);
-	    ++paren_count;
+	    return fail(Error_Code::empty_expression);
 	 }
-	 else if (token == ")")
-	 {
-	    if (paren_count == 0)
-	    {
-	      throw expression_error {"vnsterparentes saknas\n"};
-	    }
-
-	    if (previous_token == "(" && !postfix.empty())
-	    {
-	      throw expression_error {"tom parentes\n"};
-	    }
 
-	    while (!operator_stack.empty() && operator_stack.top() != "(")
-	    {
-	       postfix += operator_stack.top() + ' ';
-	       operator_stack.pop();
-	    }
+	 Expression_Tree* tree{parse_expression()};
 
-	    if (operator_stack.empty())
-	    {
-	      throw expression_error {"hgerparentes saknar matchande vnsterparentes\n"};
-	    }
-	    // Det finns en vnsterparentes p stacken
-	    operator_stack.pop();
-	    --paren_count;
-	 }
-	 else if (is_operand(token))
+	 if (tree != nullptr && current.kind == Token_Kind::right_paren)
 	 {
-	    if (last_was_operand || previous_token == ")")
-	    {
-	      throw expression_error {"operand dr operator frvntades\n"};
-	    }
-
-	    postfix += token + ' ';
-	    last_was_operand = true;
+	    return fail(Error_Code::missing_left_parenthesis);
 	 }
-	 else
+	 // Fel i resten av texten rapporteras före en felaktig tilldelning.
+	 if (tree != nullptr && invalid_assignment != string_view::npos)
 	 {
-	   throw expression_error {"otillten symbol\n"};
+	    error = Expression_Status{Error_Code::invalid_assignment, invalid_assignment};
+	    return nullptr;
 	 }
-
-	 previous_token = token;
+	 return tree;
       }
 
-      if (postfix == "")
+      const Expression_Status& status() const
       {
-	throw expression_error {"tomt infixuttryck!\n"};
+	 return error;
       }
 
-      if (!last_was_operand && !postfix.empty())
-      {
-	throw expression_error {"operator avslutar\n"};
-      }
+   private:
+      enum class Token_Kind { end, operand, binary_operator, left_paren, right_paren, invalid };
 
-      if (paren_count > 0)
+      // För operander även teckenklasserna i elementet (se
+      // Expression_Grammar.h) och antalet decimalpunkter.
+      struct Token
       {
-	throw expression_error {"hgerparentes saknas\n"};
-      }
-
-      while (!operator_stack.empty())
+	 Token_Kind    kind;
+	 string_view   text;
+	 std::size_t   start;
+	 unsigned char classes{0};
+	 std::size_t   points{0};
+      };
+
+      // Sparar det första felet, vid det aktuella lexikala elementet.
+      Expression_Tree* fail(Error_Code code)
       {
-	 postfix += operator_stack.top() + ' ';
-	 operator_stack.pop();
+	 if (error.ok())
+	 {
+	    error = Expression_Status{code, current.start};
+	 }
+	 return nullptr;
       }
 
-      if (!postfix.empty())
+      // Läser nästa lexikala element till current. Ett otillåtet tecken blir
+      // ett element av typen invalid, som rapporteras där det används.
+      void advance()
       {
-	 postfix.erase(postfix.size() - 1);
-      }
+	 while (position < input.size() && expression_grammar::is_space(input[position]))
+	 {
+	    ++position;
+	 }
 
-      return postfix;
-   }
+	 if (position == input.size())
+	 {
+	    current = Token{Token_Kind::end, {}, position};
+	    return;
+	 }
 
-   // make_expression_tree tar en postfixstrng och returnerar ett motsvarande 
-   // lnkat trd av Expression_Tree-noder.
-   Expression_Tree* make_expression_tree(const std::string& postfix)
-   {
-      using std::stack;
-      using std::string;
-      using std::istringstream;
+	 std::size_t   start{position};
+	 char          c{input[position]};
+	 unsigned char kind{character_class(c)};
 
-      stack<Expression_Tree*> tree_stack;
-      string                  token;
-      istringstream           ps{postfix};
-   try
-	      {
-      while (ps >> token)
-      {
-	 if (is_operator(token))
+	 if (kind == expression_grammar::operator_char)
+	 {
+	    current = Token{Token_Kind::binary_operator, input.substr(start, 1), start};
+	    ++position;
+	 }
+	 else if (c == '(')
+	 {
+	    current = Token{Token_Kind::left_paren, input.substr(start, 1), start};
+	    ++position;
+	 }
+	 else if (c == ')')
 	 {
-	    if (tree_stack.empty()) 
+	    current = Token{Token_Kind::right_paren, input.substr(start, 1), start};
+	    ++position;
+	 }
+	 else if (is_operand_char(c))
+	 {
+	    unsigned char classes{0};
+	    std::size_t   points{0};
+	    while (position < input.size() && is_operand_char(input[position]))
 	    {
-	      throw expression_error {"felaktig postfix\n"};
+	       classes |= character_class(input[position]);
+	       points += input[position] == '.';
+	       ++position;
 	    }
-	    Expression_Tree* rhs{tree_stack.top()};
-	    tree_stack.pop();
+	    current = Token{Token_Kind::operand, input.substr(start, position - start), start,
+			    classes, points};
+	 }
+	 else
+	 {
+	    current = Token{Token_Kind::invalid, input.substr(start, 1), start};
+	    ++position;
+	 }
+      }
 
-	    if (tree_stack.empty()) 
-	    {
-	      throw expression_error {"felaktig postfix\n"};
-	    }
-	    Expression_Tree* lhs{tree_stack.top()};
-	    tree_stack.pop();
-	 
-	    if (token == "^")
-	    {
-	       tree_stack.push(new Power{lhs, rhs});
-	    }
-	    else if (token == "*")
+      // Precedensklättringen görs med en egen stack i stället för rekursion:
+      // en ram sparar vänsteroperanden och operatorn som väntar på sin högra
+      // operand, eller en öppen parentes, tillsammans med den omgivande
+      // nivåns lägsta prioritet. Djupet begränsas därmed bara av minnet.
+      Expression_Tree* parse_expression()
+      {
+	 struct Frame
+	 {
+	    Expression_Tree* lhs;
+	    char             op;       // '(' för en parentes
+	    int              min_priority;
+	 };
+
+	 Small_Stack<Frame, 32> frames;
+	 int                    min_priority{0};
+
+	 while (true)
+	 {
+	    while (current.kind == Token_Kind::left_paren)
 	    {
-	       tree_stack.push(new Times{lhs, rhs});
+	       ++paren_count;
+	       advance();
+	       if (current.kind == Token_Kind::right_paren)
+	       {
+		  return fail(Error_Code::empty_parentheses);
+	       }
+	       frames.push_back(Frame{nullptr, '(', min_priority});
+	       min_priority = 0;
 	    }
-	    else if (token == "/")
+
+	    Expression_Tree* lhs{parse_operand()};
+	    if (lhs == nullptr)
 	    {
-	       tree_stack.push(new Divide{lhs, rhs});
+	       return nullptr;
 	    }
-	    else if (token == "+")
+
+	    while (true)
 	    {
-	       tree_stack.push(new Plus{lhs, rhs});
+	       if (current.kind == Token_Kind::invalid)
+	       {
+		  return fail(Error_Code::illegal_symbol);
+	       }
+	       if (current.kind == Token_Kind::operand || current.kind == Token_Kind::left_paren)
+	       {
+		  return fail(Error_Code::operator_expected);
+	       }
+
+	       if (current.kind == Token_Kind::binary_operator &&
+		   input_priority(current.text.front()) > min_priority)
+	       {
+		  char op{current.text.front()};
+		  if (op == '=')
+		  {
+		     if (assignment)
+		     {
+			return fail(Error_Code::multiple_assignment);
+		     }
+		     if (dynamic_cast<Variable*>(lhs) == nullptr)
+		     {
+			invalid_assignment = current.start;
+		     }
+		     assignment = true;
+		  }
+
+		  frames.push_back(Frame{lhs, op, min_priority});
+		  min_priority = stack_priority(current.text.front());
+		  advance();
+		  break;
+	       }
+
+	       // lhs är komplett på den här nivån.
+	       if (frames.empty())
+	       {
+		  return lhs;
+	       }
+
+	       Frame frame{frames.back()};
+	       frames.pop_back();
+	       if (frame.op == '(')
+	       {
+		  if (current.kind != Token_Kind::right_paren)
+		  {
+		     return fail(Error_Code::missing_right_parenthesis);
+		  }
+		  --paren_count;
+		  advance();
+	       }
+	       else
+	       {
+		  lhs = make_operator(frame.op, frame.lhs, lhs);
+	       }
+	       min_priority = frame.min_priority;
 	    }
-	    else if (token == "-")
+	 }
+      }
+
+      Expression_Tree* parse_operand()
+      {
+	 switch (current.kind)
+	 {
+	 case Token_Kind::operand:
+	 {
+	    Expression_Tree* operand{make_operand(current)};
+	    if (operand != nullptr)
 	    {
-	       tree_stack.push(new Minus{lhs, rhs});
+	       advance();
 	    }
-	    else if (token == "=")
+	    return operand;
+	 }
+	 case Token_Kind::invalid:
+	    return fail(Error_Code::illegal_symbol);
+	 case Token_Kind::binary_operator:
+	    return fail(Error_Code::operand_expected);
+	 case Token_Kind::right_paren:
+	    if (paren_count == 0)
 	    {
-	       tree_stack.push(new Assign{lhs, rhs});
+	       return fail(Error_Code::missing_left_parenthesis);
 	    }
+	    return fail(Error_Code::trailing_operator);
+	 case Token_Kind::left_paren:
+	 case Token_Kind::end:
+	    break;
 	 }
-	 else if (is_integer(token))
-	 {
-	    tree_stack.push(new Integer{std::stoll(token.c_str())});
-	 }
-	 else if (is_real(token))
+	 return fail(Error_Code::trailing_operator);
+      }
+
+      // Heltal består bara av siffror, reella tal av siffror och en
+      // decimalpunkt, variabler av bokstäver. Tal utanför typens värdemängd
+      // räknas som otillåtna symboler.
+      Expression_Tree* make_operand(const Token& token)
+      {
+	 using expression_grammar::decimal_point;
+	 using expression_grammar::digit;
+	 using expression_grammar::letter;
+
+	 const char* first{token.text.data()};
+	 const char* last{first + token.text.size()};
+
+	 if (token.classes == digit)
 	 {
-	    tree_stack.push(new Real{std::stold(token.c_str())});
+	    long long value{};
+	    if (std::from_chars(first, last, value).ec != std::errc{})
+	    {
+	       return fail(Error_Code::illegal_symbol);
+	    }
+	    return arena.make<Integer>(value);
 	 }
-	 else if (is_identifier(token))
+	 else if ((token.classes & ~(digit | decimal_point)) == 0 && token.points == 1 &&
+		  token.text.size() > 1)
 	 {
-	    tree_stack.push(new Variable{token});
+	    long double value{};
+	    auto        result = std::from_chars(first, last, value);
+	    if (result.ec != std::errc{} || result.ptr != last)
+	    {
+	       return fail(Error_Code::illegal_symbol);
+	    }
+	    return arena.make<Real>(value);
 	 }
-	 else
+	 else if (token.classes == letter)
 	 {
-	   throw expression_error {"felaktig postfix\n"};
+	    return arena.make<Variable>(string{token.text});
 	 }
+	 return fail(Error_Code::illegal_symbol);
       }
-      }
-   catch (const exception& e)
-   {
-     delete tree_stack.top();
-     tree_stack.pop();
-     cout << "undantag fngat: " << e.what() << '\n';
-   }
-      // Det ska bara finnas ett trd p stacken om korrekt postfix.
 
-      if (tree_stack.empty())
+      Expression_Tree* make_operator(char op, Expression_Tree* lhs, Expression_Tree* rhs)
       {
-	throw expression_error {"ingen postfix given\n"};
+	 switch (op)
+	 {
+	 case '^':
+	    return arena.make<Power>(lhs, rhs);
+	 case '*':
+	    return arena.make<Times>(lhs, rhs);
+	 case '/':
+	    return arena.make<Divide>(lhs, rhs);
+	 case '+':
+	    return arena.make<Plus>(lhs, rhs);
+	 case '-':
+	    return arena.make<Minus>(lhs, rhs);
+	 default:
+	    return arena.make<Assign>(lhs, rhs);
+	 }
       }
 
-      if (tree_stack.size() > 1)
+      string_view input;
+      std::size_t position{0};
+      Token       current{Token_Kind::end, {}, 0};
+      Node_Arena& arena;
+      bool        assignment{false};
+      std::size_t invalid_assignment{string_view::npos};
+      int         paren_count{0};
+      Expression_Status error{};
+   };
+
+   // Gemensam för make_expression och try_make_expression: fel i texten ges
+   // som status och result lämnas orört. Bara minnesbrist kastar.
+   Expression_Status build_expression(std::string_view infix, const Expression_Options& options,
+				      Expression& result)
+   {
+      Node_Arena* arena{new Node_Arena};
+      Expression_Tree* tree{};
+
+      try
       {
-	 while (!tree_stack.empty())
+	 Parser parser{infix, *arena};
 	 {
-	    delete tree_stack.top();
-	    tree_stack.pop();
+	    EXPRESSION_TIME_PHASE(parse);
+	    tree = parser.parse();
+	 }
+	 if (tree == nullptr)
+	 {
+	    Expression_Status status{parser.status()};
+	    delete arena;
+	    return status;
+	 }
+	 if (options.simplify)
+	 {
+	    EXPRESSION_TIME_PHASE(simplify);
+	    tree = tree->simplify(*arena);
+	 }
+	 if (options.share_subexpressions)
+	 {
+	    EXPRESSION_TIME_PHASE(share);
+	    Subtree_Table table;
+	    tree = tree->share(table);
 	 }
-	 throw expression_error {"felaktig postfix\n"};
       }
-
-      // Returnera trdet.
-      return tree_stack.top();
+      catch (...)
+      {
+	 delete arena;
+	 throw;
+      }
+      // Expression tar över arenan, även om kompileringen misslyckas.
+      Expression expression{arena, tree};
+      expression.set_number_type(options.number_type);
+      result.swap(expression);
+      return {};
    }
 } // namespace
 
-Expression make_expression(const string& infix)
+Expression make_expression(std::string_view infix, const Expression_Options& options)
 {
-   return Expression{make_expression_tree(make_postfix(infix))};
+   Expression        expression;
+   Expression_Status status{build_expression(infix, options, expression)};
+   if (!status)
+   {
+      throw expression_error {status.message()};
+   }
+   return expression;
 }
 
-
-/*klammer runt alla new (TRY). om det blir fel ngot i stil med 
-"while (!tree_stack.empty())
-	 {
-	    delete tree_stack.top();
-	    tree_stack.pop();"
- vill tmma stack.
-
-alla error ska kasta fel.
-destruktorer osv
-
-*/
+Expression_Status try_make_expression(std::string_view infix, Expression& result,
+				      const Expression_Options& options) noexcept
+{
+   try
+   {
+      return build_expression(infix, options, result);
+   }
+   catch (...)
+   {
+      return Expression_Status{Error_Code::out_of_memory};
+   }
+}
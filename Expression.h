@@ -3,9 +3,16 @@
  */
 #ifndef EXPRESSION_H
 #define EXPRESSION_H
+#include "Bytecode.h"
+#include "Expression_Status.h"
+#include "Incremental_Evaluation.h"
+#include "Native_Function.h"
 #include <iosfwd>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
 
 
 class expression_error : public std::logic_error
@@ -30,11 +37,91 @@ public:
    // OBSERVERA: DETTA ÄR ENDAST KODSKELETT - MODIFIERA OCH KOMPLETTERA!
 
   Expression(class Expression_Tree* = nullptr);
+  Expression(class Node_Arena*, class Expression_Tree*);
 
   long double evaluate() const;
+
+  // Variablerna har platser (slots) i en miljö med variable_count() värden.
+  // evaluate(environment) läser och tilldelar variabler direkt i den givna
+  // miljön; evaluate() utgår från en kopia av uttryckets egna värden.
+  //
+  // Utvärdering ändrar aldrig uttrycket: alla const-medlemmar kan anropas
+  // samtidigt från flera trådar på samma Expression, förutsatt att varje
+  // tråd använder en egen miljö eller kontext. set_variable(), tilldelning
+  // och swap får inte ske samtidigt med andra anrop.
+  long double              evaluate(long double* environment) const;
+  long double              evaluate(Evaluation_Context& context) const;
+
+  // Som evaluate men utan undantag: ett fel, t.ex. division med noll, ges
+  // som status och value ändras då inte.
+  Expression_Status        try_evaluate(long double& value) const noexcept;
+  Expression_Status        try_evaluate(long double* environment, long double& value) const noexcept;
+  Expression_Status        try_evaluate(double* environment, double& value) const noexcept;
+  Expression_Status        try_evaluate(float* environment, float& value) const noexcept;
+
+  // Värdet tillsammans med alla partiella derivator, med ett framåt- och
+  // ett bakåtsvep (reverse mode) i stället för en utvärdering per variabel.
+  // gradient får variable_count() värden: derivatan med avseende på varje
+  // variabels värde före utvärderingen. En variabel som tilldelas räknas
+  // därefter som sitt tilldelade delträd.
+  long double              evaluate_gradient(long double* environment, long double* gradient) const;
+  long double              evaluate_gradient(std::vector<long double>& gradient) const;
+
+  // Utvärdering i double eller float, med en miljö av samma typ. evaluate()
+  // räknar i uttryckets taltyp, från Expression_Options eller
+  // set_number_type(); övriga evaluate räknar i miljöns typ.
+  double                   evaluate(double* environment) const;
+  float                    evaluate(float* environment) const;
+
+  // Som motsvarande evaluate, men ett mycket stort uttryck räknas på
+  // poolens trådar: oberoende delträd blir uppgifter och resten av
+  // programmet räknar sedan ihop deras värden i samma ordning som annars,
+  // så resultatet blir exakt detsamma. Uttryck under två gånger
+  // Bytecode::parallel_grain instruktioner räknas på den anropande tråden.
+  // Flera trådar kan utvärdera samtidigt med samma pool; deras uppgifter
+  // delar då på poolens trådar.
+  long double              evaluate(Thread_Pool& pool) const;
+  long double              evaluate(long double* environment, Thread_Pool& pool) const;
+  double                   evaluate(double* environment, Thread_Pool& pool) const;
+  float                    evaluate(float* environment, Thread_Pool& pool) const;
+  Number_Type              number_type() const;
+  void                     set_number_type(Number_Type type);
+  template<typename T>
+  std::vector<T>           make_environment() const;
+  Evaluation_Context       make_context() const;
+  std::size_t              variable_count() const;
+  // Ungefärligt minnesbehov i byte för träd och program, delat mellan kopior.
+  std::size_t              memory_size() const;
+  std::size_t              variable_slot(std::string_view name) const;
+  // Som variable_slot men ger Symbol_Table::npos för en okänd variabel.
+  std::size_t              find_variable(std::string_view name) const;
+  std::vector<long double> make_environment() const;
+  void                     set_variable(std::string_view name, long double value);
+
+  // Inkrementell utvärdering: sparar delträdens värden och räknar bara om
+  // de delar som beror på variabler som ändrats sedan förra anropet.
+  Incremental_Evaluation   make_incremental() const;
+
+  // Maskinkod för uttrycket, utvärderad i double; se Native_Function.
+  Native_Function          make_native() const;
+
+  // Utvärderar uttrycket för rows rader, med variablernas värden hämtade ur
+  // columns (en kolumn per variabelnamn) och resultatet skrivet till result.
+  // Beräkningen görs blockvis i double.
+  void        evaluate_batch(const Column_Map& columns, double* result,
+                             std::size_t rows) const;
+
+  // Utskrifter i ett linjärt svep, direkt till en ström eller sist i en
+  // buffert som anroparen kan tömma och återanvända. Infixformen har bara
+  // nödvändiga parenteser. Ett tomt uttryck skrivs som ingenting.
   std::string get_postfix() const;
+  void        write_postfix(std::ostream&) const;
+  void        write_postfix(std::string& buffer) const;
+  void        write_infix(std::ostream&) const;
+  void        write_infix(std::string& buffer) const;
   bool        empty() const;
   void        print_tree(std::ostream&) const;
+  void        print_tree(std::string& buffer) const;
   void        swap(Expression&) noexcept;
 
   ~Expression();
@@ -45,15 +132,56 @@ public:
   Expression& operator = (const Expression& other);
 
  private:
-   class Expression_Tree* pointer{nullptr};
+   friend class Expression_Image_Writer;
+   friend class Expression_Program;
+
+   // Träd och program delas mellan kopior och ändras aldrig så länge de är
+   // delade; set_variable() gör först en egen kopia av programmet
+   // (copy-on-write). Trädet ändras aldrig och förblir delat.
+   struct Body;
+
+   Body&           unshared_body();
+   const Bytecode& program() const;
+
+   std::shared_ptr<Body> body{};
 };
 
+template<typename T>
+std::vector<T> Expression::make_environment() const
+{
+  std::vector<long double> values{make_environment()};
+  return std::vector<T>(values.begin(), values.end());
+}
+
 void swap(Expression&, Expression&) noexcept;
 
+/**
+ * Expression_Options: Val för hur make_expression bygger uttrycket.
+ *   simplify             - viker konstanta delträd och tillämpar säkra
+ *                          identiteter (x*1, x+0, x^1, x^2 -> x*x) på
+ *                          trädet innan det kompileras.
+ *   share_subexpressions - slår ihop strukturellt lika delträd till en nod
+ *                          (en DAG) som beräknas en gång per utvärdering.
+ *   number_type          - taltypen som evaluate() räknar i.
+ */
+struct Expression_Options
+{
+  bool        simplify{false};
+  bool        share_subexpressions{false};
+  Number_Type number_type{Number_Type::long_double_type};
+};
+
 /**
  * make_expression: Hjälpfunktion för att skapa ett Expression-objekt, givet
  * ett infixuttryck i form av en sträng.
  */
-Expression make_expression(const std::string& infix);
+Expression make_expression(std::string_view infix, const Expression_Options& options = {});
+
+/**
+ * try_make_expression: Som make_expression men utan undantag. Ett fel i
+ * texten ges som felkod och position, och result ändras då inte.
+ */
+Expression_Status try_make_expression(std::string_view infix, Expression& result,
+                                      const Expression_Options& options = {}) noexcept;
 
 #endif
@@ -0,0 +1,128 @@
+/*
+ * Expression_Cache.cc
+ */
+#include "Expression_Cache.h"
+#include "Expression_Grammar.h"
+#include <utility>
+
+using namespace std;
+
+namespace
+{
+  // Ungefärlig kostnad för en post i listan och i indexet.
+  constexpr std::size_t entry_overhead{96};
+
+  // Nyckeln är valen följda av texten utan blanktecken, utom ett mellanslag
+  // där två operander annars skulle flyta ihop ("a b" är fortfarande fel).
+  void normalize(string_view infix, const Expression_Options& options, string& key)
+  {
+    key.clear();
+    key += options.simplify ? 's' : '-';
+    key += options.share_subexpressions ? 'd' : '-';
+    key += static_cast<char>('0' + static_cast<int>(options.number_type));
+    const std::size_t prefix_size{key.size()};
+
+    bool space{false};
+    for (char c : infix)
+      {
+        if (expression_grammar::is_space(c))
+          {
+            space = true;
+            continue;
+          }
+        if (space && key.size() > prefix_size && expression_grammar::is_operand_char(c) &&
+            expression_grammar::is_operand_char(key.back()))
+          {
+            key += ' ';
+          }
+        space = false;
+        key += c;
+      }
+  }
+}
+
+Expression_Cache::Expression_Cache(std::size_t memory_limit) : limit{memory_limit}
+{
+}
+
+Expression Expression_Cache::get(std::string_view infix, const Expression_Options& options)
+{
+  // Bufferten återanvänds, så en träff allokerar inget.
+  thread_local string key;
+  normalize(infix, options, key);
+
+  {
+    lock_guard<std::mutex> lock{mutex};
+    auto it = index.find(key);
+    if (it != index.end())
+      {
+        ++hits;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->expression;
+      }
+    ++misses;
+  }
+
+  // Tolkningen sker utan lås; ett fel kastas vidare och sparas inte.
+  Expression  expression{make_expression(infix, options)};
+  std::size_t size{expression.memory_size() + key.size() + entry_overhead};
+
+  lock_guard<std::mutex> lock{mutex};
+  if (size > limit)
+    {
+      return expression;
+    }
+
+  // En annan tråd kan ha hunnit tolka samma text under tiden.
+  auto it = index.find(key);
+  if (it != index.end())
+    {
+      entries.splice(entries.begin(), entries, it->second);
+      return it->second->expression;
+    }
+
+  entries.push_front(Entry{key, expression, size});
+  index.emplace(entries.front().key, entries.begin());
+  memory += size;
+  evict();
+  return expression;
+}
+
+void Expression_Cache::evict()
+{
+  while (memory > limit && !entries.empty())
+    {
+      Entry& oldest{entries.back()};
+      index.erase(oldest.key);
+      memory -= oldest.memory;
+      entries.pop_back();
+      ++evictions;
+    }
+}
+
+Expression_Cache::Statistics Expression_Cache::statistics() const
+{
+  lock_guard<std::mutex> lock{mutex};
+  return Statistics{hits, misses, evictions, entries.size(), memory};
+}
+
+std::size_t Expression_Cache::memory_limit() const
+{
+  lock_guard<std::mutex> lock{mutex};
+  return limit;
+}
+
+void Expression_Cache::set_memory_limit(std::size_t memory_limit)
+{
+  lock_guard<std::mutex> lock{mutex};
+  limit = memory_limit;
+  evict();
+}
+
+void Expression_Cache::clear()
+{
+  lock_guard<std::mutex> lock{mutex};
+  index.clear();
+  entries.clear();
+  memory = 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Expression_Cache.h
+ */
+#ifndef EXPRESSION_CACHE_H
+#define EXPRESSION_CACHE_H
+#include "Expression.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * Expression_Cache: Minne för tolkade uttryck, med infixtexten som nyckel.
+ * get() ger samma resultat som make_expression men tolkar varje text bara
+ * en gång; en träff är en kopia som delar träd och program med cachen
+ * (copy-on-write, se Expression).
+ *
+ * Texten normaliseras först så att blanktecken inte spelar någon roll,
+ * utom mellan två operander. Felaktiga uttryck sparas inte. Cachen har en
+ * gräns för det ungefärliga minnesbehovet; när den överskrids kastas de
+ * uttryck som använts minst nyligen (LRU). Alla medlemmar kan anropas
+ * samtidigt från flera trådar, och tolkningen sker utanför låset.
+ */
+class Expression_Cache
+{
+public:
+  struct Statistics
+  {
+    std::uint64_t hits{0};
+    std::uint64_t misses{0};
+    std::uint64_t evictions{0};
+    std::size_t   entries{0};
+    std::size_t   memory{0};
+  };
+
+  explicit Expression_Cache(std::size_t memory_limit);
+
+  Expression get(std::string_view infix, const Expression_Options& options = {});
+
+  Statistics  statistics() const;
+  std::size_t memory_limit() const;
+  void        set_memory_limit(std::size_t memory_limit);
+  void        clear();
+
+private:
+  struct Entry
+  {
+    std::string key;
+    Expression  expression;
+    std::size_t memory;
+  };
+
+  using Entry_List = std::list<Entry>;
+
+  void evict();
+
+  mutable std::mutex                                          mutex;
+  Entry_List                                                  entries;   // nyast först
+  std::unordered_map<std::string_view, Entry_List::iterator>  index;
+  std::size_t                                                 limit;
+  std::size_t                                                 memory{0};
+  std::uint64_t                                               hits{0};
+  std::uint64_t                                               misses{0};
+  std::uint64_t                                               evictions{0};
+
+  Expression_Cache(const Expression_Cache&) = delete;
+  Expression_Cache& operator =(const Expression_Cache&) = delete;
+};
+
+#endif
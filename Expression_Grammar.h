@@ -0,0 +1,107 @@
+/*
+ * Expression_Grammar.h
+ */
+#ifndef EXPRESSION_GRAMMAR_H
+#define EXPRESSION_GRAMMAR_H
+
+/**
+ * Grammatikens operatorer och prioriteter, gemensamma för make_expression
+ * och den kompileringstida tolken i Static_Expression.h.
+ *
+ * Prioritetstabeller, en för inkommandeprioritet och en för stackprioritet.
+ * Högre värde inom input respektive stack anger inbördes prioritetsordning.
+ * Högre värde i input jämfört med stack för samma operator innebär
+ * högerassociativitet, det motsatta vänsterassociativitet.
+ */
+namespace expression_grammar
+{
+  struct Operator_Priority
+  {
+    char op;
+    int  input;
+    int  stack;
+  };
+
+  inline constexpr Operator_Priority priorities[]
+  {
+    {'^', 8, 7}, {'*', 5, 6}, {'/', 5, 6}, {'+', 3, 4}, {'-', 3, 4}, {'=', 2, 1}
+  };
+
+  constexpr const Operator_Priority* find_operator(char c)
+  {
+    for (const Operator_Priority& priority : priorities)
+      {
+        if (priority.op == c)
+          {
+            return &priority;
+          }
+      }
+    return nullptr;
+  }
+
+  // Teckenklasser: variabler består av gemena bokstäver, tal av siffror och
+  // högst en decimalpunkt. Klassen för varje tecken slås upp i en tabell
+  // som byggs vid kompileringen, liksom operatorernas prioriteter.
+  enum Character_Class : unsigned char
+  {
+    letter         = 1,
+    digit          = 2,
+    decimal_point  = 4,
+    operator_char  = 8,
+    space          = 16,
+    operand_char   = letter | digit | decimal_point
+  };
+
+  struct Character_Table
+  {
+    unsigned char classes[256];
+    signed char   input[256];
+    signed char   stack[256];
+  };
+
+  constexpr Character_Table make_character_table()
+  {
+    Character_Table table{};
+    for (char c{'a'}; c <= 'z'; ++c)
+      {
+        table.classes[static_cast<unsigned char>(c)] = letter;
+      }
+    for (char c{'0'}; c <= '9'; ++c)
+      {
+        table.classes[static_cast<unsigned char>(c)] = digit;
+      }
+    table.classes[static_cast<unsigned char>('.')] = decimal_point;
+    for (char c : {' ', '\t', '\n', '\v', '\f', '\r'})
+      {
+        table.classes[static_cast<unsigned char>(c)] = space;
+      }
+    for (const Operator_Priority& priority : priorities)
+      {
+        auto index = static_cast<unsigned char>(priority.op);
+        table.classes[index] = operator_char;
+        table.input[index] = static_cast<signed char>(priority.input);
+        table.stack[index] = static_cast<signed char>(priority.stack);
+      }
+    return table;
+  }
+
+  inline constexpr Character_Table character_table{make_character_table()};
+
+  constexpr unsigned char character_class(char c)
+  {
+    return character_table.classes[static_cast<unsigned char>(c)];
+  }
+
+  constexpr bool is_operator(char c)     { return character_class(c) == operator_char; }
+  constexpr int  input_priority(char op) { return character_table.input[static_cast<unsigned char>(op)]; }
+  constexpr int  stack_priority(char op) { return character_table.stack[static_cast<unsigned char>(op)]; }
+
+  constexpr bool is_letter(char c)       { return character_class(c) == letter; }
+  constexpr bool is_digit(char c)        { return character_class(c) == digit; }
+  constexpr bool is_operand_char(char c) { return (character_class(c) & operand_char) != 0; }
+  constexpr bool is_space(char c)        { return character_class(c) == space; }
+
+  static_assert(input_priority('^') == 8 && stack_priority('=') == 1 && !is_operator('('));
+}
+
+#endif
@@ -0,0 +1,573 @@
+/*
+ * Expression_Image.cc
+ */
+#include "Expression_Image.h"
+#include "Expression.h"
+#include "Expression_Tree.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <ostream>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+struct Expression_Image::Entry
+{
+  std::uint64_t first_instruction;
+  std::uint32_t instruction_count;
+  std::uint32_t max_depth;
+  std::uint32_t temporary_count;
+  std::uint32_t reserved;
+};
+
+struct Expression_Image::Name
+{
+  std::uint32_t offset;
+  std::uint32_t length;
+};
+
+namespace
+{
+  constexpr char          magic[8]{'E', 'X', 'P', 'R', 'I', 'M', 'G', '\0'};
+  constexpr std::uint32_t version{1};
+  constexpr std::uint32_t byte_order{0x01020304};
+  constexpr std::size_t   alignment{16};
+
+  // Bara de bytes som bär värdet skrivs, så att samma uttryck alltid ger
+  // samma fil; resten av en long double är utfyllnad.
+  constexpr std::size_t long_double_bytes{LDBL_MANT_DIG == 64 ? 10 : sizeof(long double)};
+
+  struct Header
+  {
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t long_double_size;
+    std::uint32_t long_double_digits;
+    std::uint64_t expression_count;
+    std::uint64_t instruction_count;
+    std::uint64_t constant_count;
+    std::uint64_t name_count;
+    std::uint64_t string_size;
+    std::uint64_t file_size;
+  };
+
+  // Instruktionerna läses direkt ur avbilden: operationen i första byten,
+  // argumentet i de fyra sista.
+  static_assert(sizeof(Instruction) == 8 && offsetof(Instruction, arg) == 4);
+  constexpr std::size_t instruction_size{sizeof(Instruction)};
+
+  std::size_t align(std::size_t offset)
+  {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+
+  // Sektionernas placering, räknad ur huvudets antal.
+  struct Layout
+  {
+    std::size_t entries;
+    std::size_t code;
+    std::size_t constants;
+    std::size_t names;
+    std::size_t strings;
+    std::size_t end;
+  };
+
+  template<typename Entry, typename Name>
+  Layout make_layout(const Header& header)
+  {
+    Layout layout{};
+    layout.entries = align(sizeof(Header));
+    layout.code = align(layout.entries + header.expression_count * sizeof(Entry));
+    layout.constants = align(layout.code + header.instruction_count * instruction_size);
+    layout.names = align(layout.constants + header.constant_count * sizeof(long double));
+    layout.strings = align(layout.names + header.name_count * sizeof(Name));
+    layout.end = layout.strings + header.string_size;
+    return layout;
+  }
+
+  [[noreturn]] void corrupt(const string& reason)
+  {
+    throw expression_error {"corrupt expression image: " + reason};
+  }
+
+  bool is_name(string_view name)
+  {
+    return !name.empty() &&
+      all_of(name.begin(), name.end(), [](char c) { return c >= 'a' && c <= 'z'; });
+  }
+
+  void pad(ostream& os, std::size_t& offset)
+  {
+    static const char zeros[alignment]{};
+    std::size_t aligned{align(offset)};
+    os.write(zeros, aligned - offset);
+    offset = aligned;
+  }
+
+  template<typename T>
+  void put(ostream& os, const T& value, std::size_t& offset)
+  {
+    os.write(reinterpret_cast<const char*>(&value), sizeof value);
+    offset += sizeof value;
+  }
+}
+
+std::size_t Expression_Image_Writer::add(const Expression& expression)
+{
+  if (expression.empty())
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+  return add(expression.program());
+}
+
+std::size_t Expression_Image_Writer::add(const Bytecode& program)
+{
+  if (program.empty())
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+  programs.push_back(program);
+  return programs.size() - 1;
+}
+
+std::size_t Expression_Image_Writer::size() const
+{
+  return programs.size();
+}
+
+void Expression_Image_Writer::write(std::ostream& os) const
+{
+  using Entry = Expression_Image::Entry;
+  using Name = Expression_Image::Name;
+
+  // Namnen internas för hela avbilden och numreras i sorterad ordning.
+  map<string, std::uint32_t, less<>> slots;
+  std::uint64_t instruction_count{0};
+  std::uint64_t constant_count{0};
+  for (const Bytecode& program : programs)
+    {
+      for (std::size_t slot{0}; slot < program.symbol_table.size(); ++slot)
+        {
+          slots.emplace(program.symbol_table.name(slot), 0);
+        }
+      instruction_count += program.code.size();
+      constant_count += program.constants.size();
+    }
+
+  std::uint64_t string_size{0};
+  std::uint32_t index{0};
+  for (auto& slot : slots)
+    {
+      slot.second = index++;
+      string_size += slot.first.size();
+    }
+
+  // Instruktionernas argument och namnens positioner är 32 bitar.
+  if (constant_count > UINT32_MAX || slots.size() > UINT32_MAX || string_size > UINT32_MAX)
+    {
+      throw expression_error {"too many constants or variables for an expression image"};
+    }
+
+  Header header{};
+  memcpy(header.magic, magic, sizeof magic);
+  header.version = version;
+  header.byte_order = byte_order;
+  header.long_double_size = sizeof(long double);
+  header.long_double_digits = LDBL_MANT_DIG;
+  header.expression_count = programs.size();
+  header.instruction_count = instruction_count;
+  header.constant_count = constant_count;
+  header.name_count = slots.size();
+  header.string_size = string_size;
+  header.file_size = make_layout<Entry, Name>(header).end;
+
+  std::size_t offset{0};
+  put(os, header, offset);
+
+  pad(os, offset);
+  std::uint64_t first_instruction{0};
+  for (const Bytecode& program : programs)
+    {
+      Entry entry{first_instruction, static_cast<std::uint32_t>(program.code.size()),
+                  static_cast<std::uint32_t>(program.max_depth),
+                  static_cast<std::uint32_t>(program.temporary_count), 0};
+      put(os, entry, offset);
+      first_instruction += program.code.size();
+    }
+
+  // Variabler och konstanter får avbildens index i stället för programmets.
+  pad(os, offset);
+  std::uint32_t first_constant{0};
+  for (const Bytecode& program : programs)
+    {
+      for (Instruction instruction : program.code)
+        {
+          switch (instruction.op)
+            {
+            case Opcode::push_constant:
+              instruction.arg += first_constant;
+              break;
+            case Opcode::load_variable:
+            case Opcode::store_variable:
+              instruction.arg = slots.find(program.symbol_table.name(instruction.arg))->second;
+              break;
+            default:
+              break;
+            }
+          unsigned char bytes[instruction_size]{};
+          bytes[0] = static_cast<unsigned char>(instruction.op);
+          memcpy(bytes + offsetof(Instruction, arg), &instruction.arg, sizeof instruction.arg);
+          os.write(reinterpret_cast<const char*>(bytes), sizeof bytes);
+          offset += sizeof bytes;
+        }
+      first_constant += static_cast<std::uint32_t>(program.constants.size());
+    }
+
+  pad(os, offset);
+  for (const Bytecode& program : programs)
+    {
+      for (long double value : program.constants)
+        {
+          unsigned char bytes[sizeof(long double)]{};
+          memcpy(bytes, &value, long_double_bytes);
+          os.write(reinterpret_cast<const char*>(bytes), sizeof bytes);
+          offset += sizeof bytes;
+        }
+    }
+
+  pad(os, offset);
+  std::uint32_t string_offset{0};
+  for (const auto& slot : slots)
+    {
+      put(os, Name{string_offset, static_cast<std::uint32_t>(slot.first.size())}, offset);
+      string_offset += static_cast<std::uint32_t>(slot.first.size());
+    }
+
+  pad(os, offset);
+  for (const auto& slot : slots)
+    {
+      os.write(slot.first.data(), slot.first.size());
+    }
+
+  if (!os)
+    {
+      throw expression_error {"could not write expression image"};
+    }
+}
+
+Expression_Image::Expression_Image(const std::string& path)
+{
+  int file{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (file < 0)
+    {
+      throw expression_error {"could not open expression image " + path};
+    }
+
+  struct stat status{};
+  if (fstat(file, &status) != 0 || status.st_size <= 0)
+    {
+      close(file);
+      corrupt("empty file");
+    }
+
+  auto  size = static_cast<std::size_t>(status.st_size);
+  void* data{mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0)};
+  close(file);
+  if (data == MAP_FAILED)
+    {
+      throw expression_error {"could not map expression image " + path};
+    }
+  mapping = data;
+  mapping_size = size;
+
+  try
+    {
+      validate(static_cast<const unsigned char*>(data), size);
+    }
+  catch (...)
+    {
+      release();
+      throw;
+    }
+}
+
+Expression_Image::Expression_Image(const void* data, std::size_t size)
+{
+  if (reinterpret_cast<std::uintptr_t>(data) % alignment != 0)
+    {
+      throw expression_error {"expression image is not aligned"};
+    }
+  validate(static_cast<const unsigned char*>(data), size);
+}
+
+Expression_Image::~Expression_Image()
+{
+  release();
+}
+
+Expression_Image::Expression_Image(Expression_Image&& other) noexcept
+{
+  *this = std::move(other);
+}
+
+Expression_Image& Expression_Image::operator =(Expression_Image&& other) noexcept
+{
+  if (this != &other)
+    {
+      release();
+      mapping = exchange(other.mapping, nullptr);
+      mapping_size = exchange(other.mapping_size, 0);
+      entries = exchange(other.entries, nullptr);
+      entry_count = exchange(other.entry_count, 0);
+      code = exchange(other.code, nullptr);
+      constants = exchange(other.constants, nullptr);
+      names = exchange(other.names, nullptr);
+      name_count = exchange(other.name_count, 0);
+      strings = exchange(other.strings, nullptr);
+    }
+  return *this;
+}
+
+void Expression_Image::release() noexcept
+{
+  if (mapping != nullptr)
+    {
+      munmap(mapping, mapping_size);
+    }
+  mapping = nullptr;
+  mapping_size = 0;
+  entries = nullptr;
+  entry_count = 0;
+  name_count = 0;
+}
+
+void Expression_Image::validate(const unsigned char* data, std::size_t size)
+{
+  Header header{};
+  if (size < sizeof header)
+    {
+      corrupt("file too small");
+    }
+  memcpy(&header, data, sizeof header);
+
+  if (memcmp(header.magic, magic, sizeof magic) != 0)
+    {
+      corrupt("not an expression image");
+    }
+  if (header.version != version)
+    {
+      corrupt("unsupported version " + to_string(header.version));
+    }
+  if (header.byte_order != byte_order || header.long_double_size != sizeof(long double) ||
+      header.long_double_digits != LDBL_MANT_DIG)
+    {
+      corrupt("written on an incompatible machine");
+    }
+
+  // Varje antal är högst filens storlek, så sektionernas gränser kan inte
+  // svämma över när de räknas ut.
+  if (header.file_size != size || header.expression_count > size ||
+      header.instruction_count > size || header.constant_count > size ||
+      header.name_count > size || header.string_size > size)
+    {
+      corrupt("wrong size");
+    }
+
+  Layout layout{make_layout<Entry, Name>(header)};
+  if (layout.end != size)
+    {
+      corrupt("wrong size");
+    }
+
+  entries = reinterpret_cast<const Entry*>(data + layout.entries);
+  entry_count = header.expression_count;
+  code = reinterpret_cast<const Instruction*>(data + layout.code);
+  constants = reinterpret_cast<const long double*>(data + layout.constants);
+  names = reinterpret_cast<const Name*>(data + layout.names);
+  name_count = header.name_count;
+  strings = reinterpret_cast<const char*>(data + layout.strings);
+
+  // Namnen ska vara giltiga variabelnamn, unika och sorterade.
+  string_view previous;
+  for (std::size_t i{0}; i < name_count; ++i)
+    {
+      if (names[i].offset > header.string_size ||
+          names[i].length > header.string_size - names[i].offset)
+        {
+          corrupt("name outside the string table");
+        }
+      string_view name{strings + names[i].offset, names[i].length};
+      if (!is_name(name) || (i > 0 && !(previous < name)))
+        {
+          corrupt("invalid variable name");
+        }
+      previous = name;
+    }
+
+  // Varje program körs symboliskt en gång: argumenten måste ligga inom sina
+  // tabeller och stacken hålla sig inom det angivna djupet, så att
+  // utvärderingen därefter kan ske utan kontroller.
+  const unsigned char* raw_code{data + layout.code};
+  vector<bool>         saved;
+  for (std::size_t e{0}; e < entry_count; ++e)
+    {
+      const Entry& entry{entries[e]};
+      if (entry.instruction_count == 0 || entry.reserved != 0 ||
+          entry.first_instruction > header.instruction_count ||
+          entry.instruction_count > header.instruction_count - entry.first_instruction ||
+          entry.max_depth > entry.instruction_count ||
+          entry.temporary_count > entry.instruction_count)
+        {
+          corrupt("invalid expression " + to_string(e));
+        }
+
+      saved.assign(entry.temporary_count, false);
+      std::size_t depth{0};
+      for (std::size_t i{0}; i < entry.instruction_count; ++i)
+        {
+          const unsigned char* bytes{raw_code + (entry.first_instruction + i) * instruction_size};
+          std::uint32_t        arg;
+          memcpy(&arg, bytes + offsetof(Instruction, arg), sizeof arg);
+          if (bytes[1] != 0 || bytes[2] != 0 || bytes[3] != 0)
+            {
+              corrupt("invalid instruction in expression " + to_string(e));
+            }
+
+          bool valid{true};
+          switch (bytes[0])
+            {
+            case static_cast<unsigned char>(Opcode::push_constant):
+              valid = arg < header.constant_count;
+              ++depth;
+              break;
+            case static_cast<unsigned char>(Opcode::load_variable):
+              valid = arg < name_count;
+              ++depth;
+              break;
+            case static_cast<unsigned char>(Opcode::store_variable):
+              valid = arg < name_count && depth >= 1;
+              break;
+            case static_cast<unsigned char>(Opcode::add):
+            case static_cast<unsigned char>(Opcode::subtract):
+            case static_cast<unsigned char>(Opcode::multiply):
+            case static_cast<unsigned char>(Opcode::divide):
+            case static_cast<unsigned char>(Opcode::power):
+              valid = depth >= 2;
+              --depth;
+              break;
+            case static_cast<unsigned char>(Opcode::save_temporary):
+              valid = arg < entry.temporary_count && depth >= 1;
+              if (valid)
+                {
+                  saved[arg] = true;
+                }
+              break;
+            case static_cast<unsigned char>(Opcode::load_temporary):
+              valid = arg < entry.temporary_count && saved[arg];
+              ++depth;
+              break;
+            default:
+              valid = false;
+              break;
+            }
+          if (!valid || depth > entry.max_depth)
+            {
+              corrupt("invalid instruction in expression " + to_string(e));
+            }
+        }
+      if (depth != 1)
+        {
+          corrupt("invalid expression " + to_string(e));
+        }
+    }
+}
+
+std::size_t Expression_Image::size() const
+{
+  return entry_count;
+}
+
+std::size_t Expression_Image::variable_count() const
+{
+  return name_count;
+}
+
+std::size_t Expression_Image::variable_slot(std::string_view name) const
+{
+  // Namnen är sorterade.
+  std::size_t low{0};
+  std::size_t high{name_count};
+  while (low < high)
+    {
+      std::size_t middle{low + (high - low) / 2};
+      string_view candidate{variable_name(middle)};
+      if (candidate == name)
+        {
+          return middle;
+        }
+      if (candidate < name)
+        {
+          low = middle + 1;
+        }
+      else
+        {
+          high = middle;
+        }
+    }
+  throw expression_error {"no variable " + std::string{name}};
+}
+
+std::string_view Expression_Image::variable_name(std::size_t slot) const
+{
+  if (slot >= name_count)
+    {
+      throw expression_error {"no variable at slot " + to_string(slot)};
+    }
+  return {strings + names[slot].offset, names[slot].length};
+}
+
+std::vector<long double> Expression_Image::make_environment() const
+{
+  return std::vector<long double>(name_count, 0);
+}
+
+long double Expression_Image::evaluate(std::size_t index, long double* environment) const
+{
+  if (index >= entry_count)
+    {
+      throw expression_error {"no expression at index " + to_string(index)};
+    }
+
+  const Entry&       entry{entries[index]};
+  const Instruction* first{code + entry.first_instruction};
+  std::size_t        scratch{std::size_t{entry.max_depth} + entry.temporary_count};
+
+  constexpr std::size_t local_size{64};
+  long double           local_stack[local_size];
+  vector<long double>   stack;
+  long double*          scratch_stack{local_stack};
+  if (scratch > local_size)
+    {
+      stack.resize(scratch);
+      scratch_stack = stack.data();
+    }
+
+  long double value{};
+  Error_Code  error{execute_instructions(first, entry.instruction_count, constants, scratch_stack,
+                                         scratch_stack + entry.max_depth, environment, value)};
+  if (error != Error_Code::none)
+    {
+      throw expression_tree_error {error_message(error)};
+    }
+  return value;
+}
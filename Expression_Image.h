@@ -0,0 +1,95 @@
+/*
+ * Expression_Image.h
+ */
+#ifndef EXPRESSION_IMAGE_H
+#define EXPRESSION_IMAGE_H
+#include "Bytecode.h"
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Expression;
+
+/**
+ * Expression_Image_Writer: Samlar färdigkompilerade uttryck och skriver dem
+ * som en binär avbild som Expression_Image kan läsa utan att tolka om dem.
+ *
+ * Avbilden (version 1) består av ett huvud följt av sektioner, var och en
+ * 16-byte-justerad: en post per uttryck, instruktionerna för alla uttryck,
+ * en gemensam konstantpool, variabelnamnen och till sist namnens tecken.
+ * Namnen är gemensamma för hela filen och sorterade, och instruktionerna
+ * refererar direkt till namnens och konstanternas index. Talen lagras i
+ * maskinens eget format; huvudet anger byteordning och long double-format
+ * så att en avbild från en annan sorts maskin avvisas.
+ */
+class Expression_Image_Writer
+{
+public:
+  // Returnerar uttryckets index i avbilden.
+  std::size_t add(const Expression& expression);
+  std::size_t add(const Bytecode& program);
+  std::size_t size() const;
+
+  void write(std::ostream& os) const;
+
+private:
+  std::vector<Bytecode> programs;
+};
+
+/**
+ * Expression_Image: En avbild skriven av Expression_Image_Writer, mappad
+ * direkt från en fil med mmap eller läst ur ett minnesområde som anroparen
+ * äger. Hela avbilden kontrolleras när den öppnas, så att en trasig fil ger
+ * expression_error i stället för en krasch; därefter utvärderas uttrycken
+ * direkt ur avbilden utan att några träd byggs.
+ *
+ * Miljön har en plats per variabelnamn i hela avbilden (variable_count()),
+ * och alla uttryck läser och tilldelar variabler i samma miljö.
+ */
+class Expression_Image
+{
+public:
+  explicit Expression_Image(const std::string& path);
+  // data måste vara 16-byte-justerad och leva lika länge som avbilden.
+  Expression_Image(const void* data, std::size_t size);
+  ~Expression_Image();
+
+  Expression_Image(Expression_Image&& other) noexcept;
+  Expression_Image& operator =(Expression_Image&& other) noexcept;
+
+  std::size_t              size() const;
+  std::size_t              variable_count() const;
+  std::size_t              variable_slot(std::string_view name) const;
+  std::string_view         variable_name(std::size_t slot) const;
+  std::vector<long double> make_environment() const;
+
+  long double evaluate(std::size_t index, long double* environment) const;
+
+private:
+  friend class Expression_Image_Writer;
+
+  struct Entry;
+  struct Name;
+
+  void validate(const unsigned char* data, std::size_t size);
+  void release() noexcept;
+
+  void*              mapping{nullptr};
+  std::size_t        mapping_size{0};
+
+  const Entry*       entries{nullptr};
+  std::size_t        entry_count{0};
+  const Instruction* code{nullptr};
+  const long double* constants{nullptr};
+  const Name*        names{nullptr};
+  std::size_t        name_count{0};
+  const char*        strings{nullptr};
+
+  Expression_Image(const Expression_Image&) = delete;
+  Expression_Image& operator =(const Expression_Image&) = delete;
+};
+
+#endif
@@ -0,0 +1,364 @@
+/*
+ * Expression_Program.cc
+ */
+#include "Expression_Program.h"
+#include "Expression_Grammar.h"
+#include "Expression_Tree.h"
+#include <algorithm>
+#include <new>
+#include <utility>
+
+using namespace std;
+
+namespace
+{
+  // En nivå delas bara mellan trådar om varje del får minst så här många
+  // instruktioner; för mindre nivåer kostar synkroniseringen mer än den ger.
+  // Gäller hela satser, till skillnad från Bytecode::parallel_grain som
+  // gäller delar av ett enskilt uttryck.
+  constexpr std::size_t level_grain{2048};
+
+  void throw_if_failed(Error_Code error)
+  {
+    if (error == Error_Code::out_of_memory)
+      {
+        throw bad_alloc{};
+      }
+    if (error != Error_Code::none)
+      {
+        throw expression_tree_error {error_message(error)};
+      }
+  }
+
+  bool is_blank(string_view text)
+  {
+    return all_of(text.begin(), text.end(), expression_grammar::is_space);
+  }
+}
+
+Expression_Status Expression_Program::build(std::string_view text, const Expression_Options& options,
+                                            Expression_Program& result)
+{
+  Expression_Program program;
+  program.type = options.number_type;
+
+  // Satserna tolkas var för sig.
+  for (std::size_t begin{0}; begin <= text.size();)
+    {
+      std::size_t end{min(text.find_first_of(";\n", begin), text.size())};
+      string_view source{text.substr(begin, end - begin)};
+      if (!is_blank(source))
+        {
+          Expression        expression;
+          Expression_Status status{try_make_expression(source, expression, options)};
+          if (status.code == Error_Code::out_of_memory)
+            {
+              throw bad_alloc{};
+            }
+          if (!status)
+            {
+              status.position += begin;
+              return status;
+            }
+          program.expressions.push_back(std::move(expression));
+        }
+      begin = end + 1;
+    }
+  if (program.expressions.empty())
+    {
+      return Expression_Status{Error_Code::empty_expression};
+    }
+
+  // Varje satsprogram får programmets variabelplatser i stället för sina
+  // egna. Satsernas egna symboltabeller och parallella planer, som gäller
+  // de gamla platserna, behövs sedan inte.
+  vector<Statement> in_order;
+  for (std::size_t i{0}; i < program.expressions.size(); ++i)
+    {
+      Statement           statement{program.expressions[i].program(), i};
+      const Symbol_Table& local{statement.program.symbols()};
+      vector<std::size_t> slots(local.size());
+      for (std::size_t slot{0}; slot < local.size(); ++slot)
+        {
+          slots[slot] = program.symbols.intern(local.name(slot), local.initial_values()[slot]);
+        }
+      for (Instruction& instruction : statement.program.code)
+        {
+          if (instruction.op == Opcode::load_variable || instruction.op == Opcode::store_variable)
+            {
+              instruction.arg = static_cast<std::uint32_t>(slots[instruction.arg]);
+            }
+        }
+      Symbol_Table{}.swap(statement.program.symbols());
+      statement.program.temporaries.clear();
+      statement.program.parallel_plan.reset();
+      in_order.push_back(std::move(statement));
+    }
+
+  // Nivåer: en sats hamnar efter den senaste tidigare satsen som tilldelar
+  // en variabel den läser eller tilldelar, och efter alla tidigare satser
+  // som läst den variabel den tilldelar sedan den senast tilldelades.
+  constexpr std::size_t none{Symbol_Table::npos};
+  vector<std::size_t>   writer(program.symbols.size(), none);
+  vector<std::size_t>   reader(program.symbols.size(), none);
+  auto after = [](std::size_t level, std::size_t other)
+  {
+    return other == none ? level : max(level, other + 1);
+  };
+
+  std::size_t level_count{0};
+  for (const Statement& statement : in_order)
+    {
+      std::size_t level{0};
+      std::size_t target{none};
+      for (const Instruction& instruction : statement.program.code)
+        {
+          if (instruction.op == Opcode::load_variable)
+            {
+              level = after(level, writer[instruction.arg]);
+            }
+          else if (instruction.op == Opcode::store_variable)
+            {
+              target = instruction.arg;
+            }
+        }
+      if (target != none)
+        {
+          level = after(after(level, writer[target]), reader[target]);
+        }
+
+      for (const Instruction& instruction : statement.program.code)
+        {
+          if (instruction.op == Opcode::load_variable)
+            {
+              std::size_t& r{reader[instruction.arg]};
+              r = r == none ? level : max(r, level);
+            }
+        }
+      if (target != none)
+        {
+          writer[target] = level;
+          reader[target] = none;
+        }
+      program.levels.push_back(level);
+      level_count = max(level_count, level + 1);
+    }
+
+  // Satserna grupperas efter nivå, i textens ordning inom varje nivå.
+  program.level_begin.assign(level_count + 1, 0);
+  program.level_cost.assign(level_count, 0);
+  for (std::size_t i{0}; i < in_order.size(); ++i)
+    {
+      ++program.level_begin[program.levels[i] + 1];
+      program.level_cost[program.levels[i]] += in_order[i].program.code.size();
+    }
+  for (std::size_t level{0}; level < level_count; ++level)
+    {
+      program.level_begin[level + 1] += program.level_begin[level];
+    }
+  vector<std::size_t> position(program.level_begin.begin(), program.level_begin.end() - 1);
+  vector<Statement*>  sorted(in_order.size());
+  for (std::size_t i{0}; i < in_order.size(); ++i)
+    {
+      sorted[position[program.levels[i]]++] = &in_order[i];
+    }
+  program.statements.reserve(in_order.size());
+  for (Statement* statement : sorted)
+    {
+      program.statements.push_back(std::move(*statement));
+    }
+
+  swap(result, program);
+  return {};
+}
+
+Expression_Program make_program(std::string_view text, const Expression_Options& options)
+{
+  Expression_Program program;
+  Expression_Status  status{Expression_Program::build(text, options, program)};
+  if (!status)
+    {
+      throw expression_error {status.message()};
+    }
+  return program;
+}
+
+Expression_Status try_make_program(std::string_view text, Expression_Program& result,
+                                   const Expression_Options& options) noexcept
+{
+  try
+    {
+      return Expression_Program::build(text, options, result);
+    }
+  catch (...)
+    {
+      return Expression_Status{Error_Code::out_of_memory};
+    }
+}
+
+std::size_t Expression_Program::statement_count() const
+{
+  return expressions.size();
+}
+
+const Expression& Expression_Program::statement(std::size_t index) const
+{
+  return expressions.at(index);
+}
+
+std::size_t Expression_Program::level_count() const
+{
+  return level_cost.size();
+}
+
+std::size_t Expression_Program::level(std::size_t statement) const
+{
+  return levels.at(statement);
+}
+
+std::size_t Expression_Program::variable_count() const
+{
+  return symbols.size();
+}
+
+std::size_t Expression_Program::variable_slot(std::string_view name) const
+{
+  std::size_t slot{symbols.slot(name)};
+  if (slot == Symbol_Table::npos)
+    {
+      throw expression_error {"no variable " + std::string{name}};
+    }
+  return slot;
+}
+
+std::size_t Expression_Program::find_variable(std::string_view name) const
+{
+  return symbols.slot(name);
+}
+
+const std::string& Expression_Program::variable_name(std::size_t slot) const
+{
+  return symbols.name(slot);
+}
+
+std::vector<long double> Expression_Program::make_environment() const
+{
+  return symbols.initial_values();
+}
+
+long double Expression_Program::evaluate() const
+{
+  // Som Expression::evaluate(): i programmets taltyp, från en kopia av
+  // variablernas startvärden.
+  switch (type)
+    {
+    case Number_Type::float_type:
+      {
+        std::vector<float> environment{make_environment<float>()};
+        return run(environment.data(), nullptr);
+      }
+    case Number_Type::double_type:
+      {
+        std::vector<double> environment{make_environment<double>()};
+        return run(environment.data(), nullptr);
+      }
+    case Number_Type::long_double_type:
+      break;
+    }
+  std::vector<long double> environment{make_environment()};
+  return run(environment.data(), nullptr);
+}
+
+long double Expression_Program::evaluate(long double* environment) const
+{
+  return run(environment, nullptr);
+}
+
+double Expression_Program::evaluate(double* environment) const
+{
+  return run(environment, nullptr);
+}
+
+float Expression_Program::evaluate(float* environment) const
+{
+  return run(environment, nullptr);
+}
+
+long double Expression_Program::evaluate(long double* environment, Thread_Pool& pool) const
+{
+  return run(environment, &pool);
+}
+
+double Expression_Program::evaluate(double* environment, Thread_Pool& pool) const
+{
+  return run(environment, &pool);
+}
+
+float Expression_Program::evaluate(float* environment, Thread_Pool& pool) const
+{
+  return run(environment, &pool);
+}
+
+Number_Type Expression_Program::number_type() const
+{
+  return type;
+}
+
+template<typename T>
+T Expression_Program::run(T* environment, Thread_Pool* pool) const
+{
+  if (statements.empty())
+    {
+      throw expression_error {"no expression to evaluate"};
+    }
+
+  const std::size_t  last{expressions.size() - 1};
+  const std::size_t  threads{pool != nullptr ? pool->size() : 1};
+  T                  result{};
+  vector<Error_Code> errors(threads);
+
+  // Nivåerna utförs i ordning; satserna inom en nivå delas i
+  // sammanhängande delar, en per tråd. Utan pool är varje nivå en del,
+  // vilket ger satserna i textens ordning för varje variabel.
+  for (std::size_t level{0}; level < level_count(); ++level)
+    {
+      const std::size_t begin{level_begin[level]};
+      const std::size_t width{level_begin[level + 1] - begin};
+      const std::size_t parts{min({threads, width,
+                                   max<std::size_t>(level_cost[level] / level_grain, 1)})};
+
+      auto run_part = [&](std::size_t part)
+      {
+        std::size_t first{begin + width * part / parts};
+        std::size_t stop{begin + width * (part + 1) / parts};
+        for (std::size_t i{first}; i < stop; ++i)
+          {
+            T          value{};
+            Error_Code error{statements[i].program.try_run(environment, value)};
+            if (error != Error_Code::none)
+              {
+                errors[part] = error;
+                return;
+              }
+            if (statements[i].source == last)
+              {
+                result = value;
+              }
+          }
+      };
+
+      if (parts == 1)
+        {
+          run_part(0);
+        }
+      else
+        {
+          pool->run(parts, run_part);
+        }
+      for (std::size_t part{0}; part < parts; ++part)
+        {
+          throw_if_failed(errors[part]);
+        }
+    }
+  return result;
+}
@@ -0,0 +1,100 @@
+/*
+ * Expression_Program.h
+ */
+#ifndef EXPRESSION_PROGRAM_H
+#define EXPRESSION_PROGRAM_H
+#include "Expression.h"
+#include "Thread_Pool.h"
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Expression_Program: Flera satser, åtskilda av ';' eller radbrytning, som
+ * delar variabler, t.ex. "t = a * b; u = t + c; v = t ^ 2". Varje sats är
+ * ett uttryck som för make_expression och får ha en tilldelning. Satserna
+ * kompileras till program med gemensamma variabelplatser i en miljö, så
+ * att t ovan räknas ut en gång och läses av de senare satserna.
+ *
+ * Resultatet är som om satserna utfördes i textens ordning. En sats beror
+ * på de tidigare satser som tilldelar en variabel den läser, tilldelar
+ * samma variabel eller läser den variabel den själv tilldelar. Satserna
+ * delas efter beroendena in i nivåer; satserna inom en nivå är oberoende
+ * och kan utföras parallellt med en Thread_Pool. En enskild sats delas
+ * inte upp mellan trådarna.
+ *
+ * evaluate ger värdet av sista satsen. Efter ett fel i en sats är miljön
+ * bara delvis uppdaterad. evaluate() räknar i taltypen från
+ * Expression_Options::number_type, övriga evaluate i miljöns typ.
+ */
+class Expression_Program
+{
+public:
+  std::size_t              statement_count() const;
+  const Expression&        statement(std::size_t index) const;
+  // Antal nivåer, dvs. längsta kedjan av beroende satser.
+  std::size_t              level_count() const;
+  std::size_t              level(std::size_t statement) const;
+
+  std::size_t              variable_count() const;
+  std::size_t              variable_slot(std::string_view name) const;
+  // Som variable_slot men ger Symbol_Table::npos för en okänd variabel.
+  std::size_t              find_variable(std::string_view name) const;
+  const std::string&       variable_name(std::size_t slot) const;
+  std::vector<long double> make_environment() const;
+  template<typename T>
+  std::vector<T>           make_environment() const;
+  Number_Type              number_type() const;
+
+  long double              evaluate() const;
+  long double              evaluate(long double* environment) const;
+  double                   evaluate(double* environment) const;
+  float                    evaluate(float* environment) const;
+  long double              evaluate(long double* environment, Thread_Pool& pool) const;
+  double                   evaluate(double* environment, Thread_Pool& pool) const;
+  float                    evaluate(float* environment, Thread_Pool& pool) const;
+
+private:
+  friend Expression_Program make_program(std::string_view, const Expression_Options&);
+  friend Expression_Status  try_make_program(std::string_view, Expression_Program&,
+                                             const Expression_Options&) noexcept;
+
+  // Fel i texten ges som status; bara minnesbrist kastar.
+  static Expression_Status build(std::string_view text, const Expression_Options& options,
+                                 Expression_Program& result);
+  // Utan pool utförs nivåerna på den anropande tråden.
+  template<typename T> T run(T* environment, Thread_Pool* pool) const;
+
+  struct Statement
+  {
+    Bytecode    program;          // med programmets gemensamma variabelplatser
+    std::size_t source;           // index i expressions
+  };
+
+  std::vector<Expression>  expressions;    // i textens ordning
+  std::vector<std::size_t> levels;         // nivå per sats, i textens ordning
+  std::vector<Statement>   statements;     // sorterade efter nivå
+  std::vector<std::size_t> level_begin;    // första satsen per nivå, plus slutet
+  std::vector<std::size_t> level_cost;     // antal instruktioner per nivå
+  Symbol_Table             symbols;
+  Number_Type              type{Number_Type::long_double_type};
+};
+
+template<typename T>
+std::vector<T> Expression_Program::make_environment() const
+{
+  std::vector<long double> values{make_environment()};
+  return std::vector<T>(values.begin(), values.end());
+}
+
+/**
+ * make_program: Tolkar satserna och bygger programmet.
+ * try_make_program: Samma sak utan undantag; positionen i ett fel gäller
+ * hela texten.
+ */
+Expression_Program make_program(std::string_view text, const Expression_Options& options = {});
+Expression_Status  try_make_program(std::string_view text, Expression_Program& result,
+                                    const Expression_Options& options = {}) noexcept;
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Expression_Status.h
+ */
+#ifndef EXPRESSION_STATUS_H
+#define EXPRESSION_STATUS_H
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Error_Code: Orsaken till att en tolkning eller utvärdering misslyckades.
+ */
+enum class Error_Code : std::uint8_t
+{
+  none,
+  // Fel i infixtexten.
+  empty_expression,
+  illegal_symbol,
+  empty_parentheses,
+  missing_left_parenthesis,
+  missing_right_parenthesis,
+  operand_expected,
+  operator_expected,
+  trailing_operator,
+  multiple_assignment,
+  invalid_assignment,
+  // Fel vid utvärdering.
+  no_expression,
+  division_by_zero,
+  out_of_memory
+};
+
+/**
+ * error_message: Samma text som motsvarande undantag har som what().
+ */
+inline const char* error_message(Error_Code code) noexcept
+{
+  switch (code)
+    {
+    case Error_Code::none:                      return "";
+    case Error_Code::empty_expression:          return "tomt infixuttryck!\n";
+    case Error_Code::illegal_symbol:            return "otillåten symbol\n";
+    case Error_Code::empty_parentheses:         return "tom parentes\n";
+    case Error_Code::missing_left_parenthesis:  return "vänsterparentes saknas\n";
+    case Error_Code::missing_right_parenthesis: return "högerparentes saknas\n";
+    case Error_Code::operand_expected:          return "operator där operand förväntades\n";
+    case Error_Code::operator_expected:         return "operand där operator förväntades\n";
+    case Error_Code::trailing_operator:         return "operator avslutar\n";
+    case Error_Code::multiple_assignment:       return "multipel tilldelning";
+    case Error_Code::invalid_assignment:        return "tilldelning till annat än en variabel\n";
+    case Error_Code::no_expression:             return "no expression to evaluate";
+    case Error_Code::division_by_zero:          return "do not divide by zero";
+    case Error_Code::out_of_memory:             return "out of memory";
+    }
+  return "";
+}
+
+/**
+ * Expression_Status: Resultatet av ett anrop som inte kastar undantag.
+ * position är tecknet i infixtexten där ett fel i texten upptäcktes, och
+ * 0 för fel vid utvärdering.
+ */
+struct Expression_Status
+{
+  Error_Code  code{Error_Code::none};
+  std::size_t position{0};
+
+  bool        ok() const noexcept      { return code == Error_Code::none; }
+  const char* message() const noexcept { return error_message(code); }
+
+  explicit operator bool() const noexcept { return ok(); }
+};
+
+#endif
@@ -2,23 +2,629 @@
  * Expression_Tree.cc
  */
 #include "Expression_Tree.h"
+#include "Bytecode.h"
+#include "Instrumentation.h"
+#include "Node_Arena.h"
+#include "Subtree_Table.h"
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 
-void Binary_Operator::print(std::ostream& os, int counter) const 
- {
-   rightop->print(os, ++counter);
-    os << std::setw(counter) << " /" << '\n';
-    os << std::setw(counter - 1) << str() << '\n';
-    os << std::setw(counter) << " \\" << '\n';
-    leftop->print(os, counter);
+namespace
+{
+  bool is_constant(const Expression_Tree* node)
+  {
+    return dynamic_cast<const Integer*>(node) != nullptr ||
+      dynamic_cast<const Real*>(node) != nullptr;
   }
 
-std::string Binary_Operator::get_postfix() const 
+  bool is_constant(const Expression_Tree* node, long double value)
+  {
+    return is_constant(node) && node->evaluate() == value;
+  }
+}
+
+namespace
+{
+  // Ett steg i en genomgång: noden och om dess barn redan är behandlade.
+  template<typename Node>
+  struct Visit
+  {
+    Node* node;
+    bool  done;
+  };
+}
+
+namespace
+{
+  // Mål för utskrifterna: en ström eller slutet av en buffert.
+  struct Stream_Sink
+  {
+    std::ostream& os;
+
+    void put(std::string_view text) { os.write(text.data(), text.size()); }
+    void put(char c) { os.put(c); }
+    void pad(std::ptrdiff_t count)
+    {
+      for (; count > 0; --count)
+        {
+          os.put(' ');
+        }
+    }
+  };
+
+  struct Buffer_Sink
+  {
+    std::string& buffer;
+
+    void put(std::string_view text) { buffer.append(text); }
+    void put(char c) { buffer.push_back(c); }
+    void pad(std::ptrdiff_t count)
+    {
+      if (count > 0)
+        {
+          buffer.append(count, ' ');
+        }
+    }
+  };
+
+  std::string_view symbol(Opcode op)
   {
-    return leftop->get_postfix() + " " + rightop->get_postfix() + " " + str();
+    switch (op)
+      {
+      case Opcode::add:      return "+";
+      case Opcode::subtract: return "-";
+      case Opcode::multiply: return "*";
+      case Opcode::divide:   return "/";
+      case Opcode::power:    return "^";
+      default:               return "=";
+      }
   }
 
+  // Bindningsstyrka och associativitet, som i parserns prioritetstabeller.
+  int precedence(Opcode op)
+  {
+    switch (op)
+      {
+      case Opcode::power:    return 4;
+      case Opcode::multiply:
+      case Opcode::divide:   return 3;
+      case Opcode::add:
+      case Opcode::subtract: return 2;
+      default:               return 1;
+      }
+  }
+
+  bool right_associative(Opcode op)
+  {
+    return op == Opcode::power || op == Opcode::store_variable;
+  }
+
+  template<typename Sink>
+  void write_postfix(const Expression_Tree* root, Sink& sink)
+  {
+    Expression_Tree::Token_Buffer scratch;
+    vector<Visit<const Expression_Tree>> work{{root, false}};
+    bool first{true};
+    while (!work.empty())
+      {
+        auto visit = work.back();
+        work.pop_back();
+        auto op = Binary_Operator::as_binary(visit.node);
+        if (op != nullptr && !visit.done)
+          {
+            work.push_back({op, true});
+            work.push_back({op->right(), false});
+            work.push_back({op->left(), false});
+            continue;
+          }
+
+        if (!first)
+          {
+            sink.put(' ');
+          }
+        first = false;
+        sink.put(visit.node->token(scratch));
+      }
+  }
+
+  template<typename Sink>
+  void write_infix(const Expression_Tree* root, Sink& sink)
+  {
+    enum class Piece_Kind { subtree, open, close, symbol };
+    struct Piece
+    {
+      const Expression_Tree* node;
+      Piece_Kind             kind;
+    };
+
+    // Ett barn behöver parentes om det binder svagare än föräldern, eller
+    // lika starkt men står på den sida där associativiteten inte räcker.
+    auto needs_parentheses = [](const Binary_Operator* parent, const Expression_Tree* child,
+                                bool left_side)
+      {
+        auto op = Binary_Operator::as_binary(child);
+        if (op == nullptr)
+          {
+            return false;
+          }
+        int outer{precedence(parent->opcode())};
+        int inner{precedence(op->opcode())};
+        return inner < outer ||
+          (inner == outer && left_side == right_associative(parent->opcode()));
+      };
+
+    Expression_Tree::Token_Buffer scratch;
+    vector<Piece> work{{root, Piece_Kind::subtree}};
+    while (!work.empty())
+      {
+        Piece piece{work.back()};
+        work.pop_back();
+        switch (piece.kind)
+          {
+          case Piece_Kind::open:
+            sink.put('(');
+            break;
+          case Piece_Kind::close:
+            sink.put(')');
+            break;
+          case Piece_Kind::symbol:
+            sink.put(' ');
+            sink.put(piece.node->token(scratch));
+            sink.put(' ');
+            break;
+          case Piece_Kind::subtree:
+            auto op = Binary_Operator::as_binary(piece.node);
+            if (op == nullptr)
+              {
+                sink.put(piece.node->token(scratch));
+                break;
+              }
+
+            bool left_parentheses{needs_parentheses(op, op->left(), true)};
+            bool right_parentheses{needs_parentheses(op, op->right(), false)};
+            if (right_parentheses)
+              {
+                work.push_back({nullptr, Piece_Kind::close});
+              }
+            work.push_back({op->right(), Piece_Kind::subtree});
+            if (right_parentheses)
+              {
+                work.push_back({nullptr, Piece_Kind::open});
+              }
+            work.push_back({op, Piece_Kind::symbol});
+            if (left_parentheses)
+              {
+                work.push_back({nullptr, Piece_Kind::close});
+              }
+            work.push_back({op->left(), Piece_Kind::subtree});
+            if (left_parentheses)
+              {
+                work.push_back({nullptr, Piece_Kind::open});
+              }
+            break;
+          }
+      }
+  }
+
+  template<typename Sink>
+  void write_tree(const Expression_Tree* root, Sink& sink, int counter)
+  {
+    // Höger delträd skrivs överst, sedan operatorn och sist vänster delträd,
+    // alla med ett steg större indrag än föräldern. En operand skrivs
+    // högerjusterad i counter + 1 tecken.
+    struct Line
+    {
+      const Expression_Tree* node;
+      int                    counter;
+      bool                   done;
+    };
+
+    Expression_Tree::Token_Buffer scratch;
+    vector<Line> work{{root, counter, false}};
+    while (!work.empty())
+      {
+        Line line{work.back()};
+        work.pop_back();
+        auto op = Binary_Operator::as_binary(line.node);
+        if (op == nullptr)
+          {
+            std::string_view text{line.node->token(scratch)};
+            sink.pad(line.counter + 1 - static_cast<std::ptrdiff_t>(text.size()));
+            sink.put(text);
+            sink.put('\n');
+          }
+        else if (!line.done)
+          {
+            int inner{line.counter + 1};
+            work.push_back({op->left(), inner, false});
+            work.push_back({op, inner, true});
+            work.push_back({op->right(), inner, false});
+          }
+        else
+          {
+            std::string_view text{op->token(scratch)};
+            sink.pad(line.counter - 2);
+            sink.put(" /\n");
+            sink.pad(line.counter - 1 - static_cast<std::ptrdiff_t>(text.size()));
+            sink.put(text);
+            sink.put('\n');
+            sink.pad(line.counter - 2);
+            sink.put(" \\\n");
+          }
+      }
+  }
+}
+
+void Expression_Tree::write_postfix(std::ostream& os) const
+{
+  Stream_Sink sink{os};
+  ::write_postfix(this, sink);
+}
+
+void Expression_Tree::write_postfix(std::string& buffer) const
+{
+  Buffer_Sink sink{buffer};
+  ::write_postfix(this, sink);
+}
+
+void Expression_Tree::write_infix(std::ostream& os) const
+{
+  Stream_Sink sink{os};
+  ::write_infix(this, sink);
+}
+
+void Expression_Tree::write_infix(std::string& buffer) const
+{
+  Buffer_Sink sink{buffer};
+  ::write_infix(this, sink);
+}
+
+void Expression_Tree::write_tree(std::ostream& os) const
+{
+  Stream_Sink sink{os};
+  ::write_tree(this, sink, 3);
+}
+
+void Expression_Tree::write_tree(std::string& buffer) const
+{
+  Buffer_Sink sink{buffer};
+  ::write_tree(this, sink, 3);
+}
+
+Binary_Operator* Binary_Operator::as_binary(Expression_Tree* node)
+{
+  return node != nullptr && node->binary ? static_cast<Binary_Operator*>(node) : nullptr;
+}
+
+const Binary_Operator* Binary_Operator::as_binary(const Expression_Tree* node)
+{
+  return node != nullptr && node->binary ? static_cast<const Binary_Operator*>(node) : nullptr;
+}
+
+Binary_Operator::~Binary_Operator()
+{
+  if (in_arena)
+    {
+      return;
+    }
+
+  // Operander tas bort direkt. Operatornoder läggs på en stack och lossas
+  // från sina barn innan de tas bort, så att inget destruktoranrop behöver
+  // gå vidare nedåt i trädet.
+  vector<Binary_Operator*> work;
+  auto release = [&work](Expression_Tree* node)
+    {
+      if (Binary_Operator* op = as_binary(node))
+        {
+          work.push_back(op);
+        }
+      else
+        {
+          delete node;
+        }
+    };
+
+  release(leftop);
+  release(rightop);
+  while (!work.empty())
+    {
+      Binary_Operator* op{work.back()};
+      work.pop_back();
+      release(op->leftop);
+      release(op->rightop);
+      op->leftop = nullptr;
+      op->rightop = nullptr;
+      delete op;
+    }
+}
+
+long double Binary_Operator::evaluate() const
+{
+  // Postordning: vänster delträd, höger delträd och sedan operatorn.
+  // Stegen räknas som motsvarande instruktioner i Bytecode.
+  vector<long double> values;
+  vector<Visit<const Expression_Tree>> work{{this, false}};
+  EXPRESSION_ONLY(std::uint64_t operations[instrumentation::opcode_count]{};)
+  while (!work.empty())
+    {
+      auto visit = work.back();
+      work.pop_back();
+      auto op = as_binary(visit.node);
+      if (op == nullptr)
+        {
+          EXPRESSION_ONLY(++operations[static_cast<std::size_t>(
+            dynamic_cast<const Variable*>(visit.node) != nullptr ? Opcode::load_variable
+                                                                 : Opcode::push_constant)];)
+          values.push_back(visit.node->evaluate());
+        }
+      else if (!visit.done)
+        {
+          work.push_back({op, true});
+          work.push_back({op->rightop, false});
+          work.push_back({op->leftop, false});
+        }
+      else
+        {
+          long double right{values.back()};
+          values.pop_back();
+          values.back() = op->apply(values.back(), right);
+          EXPRESSION_ONLY(++operations[static_cast<std::size_t>(op->opcode())];)
+        }
+    }
+  EXPRESSION_ONLY(instrumentation::add_operations(operations);)
+  return values.back();
+}
+
+void Binary_Operator::print(std::ostream& os, int counter) const 
+{
+  Stream_Sink sink{os};
+  ::write_tree(this, sink, counter);
+}
+
+std::string Binary_Operator::get_postfix() const 
+{
+  std::string postfix;
+  write_postfix(postfix);
+  return postfix;
+}
+
+std::string_view Binary_Operator::token(Token_Buffer&) const
+{
+  return symbol(opcode());
+}
+
+Binary_Operator* Binary_Operator::clone_tree(Node_Arena* arena) const
+{
+  EXPRESSION_COUNT(clones, 1);
+  vector<Expression_Tree*> copies;
+  vector<Visit<const Expression_Tree>> work{{this, false}};
+
+  // I en arena förblir en DAG en DAG: en delad nod kopieras en gång och
+  // kopian delas på samma sätt. Utan arena äger varje förälder sina barn,
+  // så där blir varje förekomst en egen kopia.
+  unordered_map<const Expression_Tree*, Expression_Tree*> shared_copies;
+  auto remember = [&](const Expression_Tree* node, Expression_Tree* copy)
+  {
+    if (arena != nullptr && node->shared)
+      {
+        copy->shared = true;
+        shared_copies.emplace(node, copy);
+      }
+  };
+
+  try
+    {
+      while (!work.empty())
+        {
+          auto visit = work.back();
+          work.pop_back();
+          if (arena != nullptr && visit.node->shared && !visit.done)
+            {
+              auto it = shared_copies.find(visit.node);
+              if (it != shared_copies.end())
+                {
+                  copies.push_back(it->second);
+                  continue;
+                }
+            }
+
+          auto op = as_binary(visit.node);
+          if (op == nullptr)
+            {
+              copies.push_back(visit.node->clone(arena));
+              remember(visit.node, copies.back());
+            }
+          else if (!visit.done)
+            {
+              work.push_back({op, true});
+              work.push_back({op->rightop, false});
+              work.push_back({op->leftop, false});
+            }
+          else
+            {
+              Expression_Tree* right{copies.back()};
+              copies.pop_back();
+              copies.back() = op->copy(arena, copies.back(), right);
+              remember(op, copies.back());
+              EXPRESSION_COUNT(cloned_nodes, 1);
+            }
+        }
+    }
+  catch (...)
+    {
+      // Kopior i en arena tas bort med arenan.
+      if (arena == nullptr)
+        {
+          for (Expression_Tree* copy : copies)
+            {
+              delete copy;
+            }
+        }
+      throw;
+    }
+  return static_cast<Binary_Operator*>(copies.back());
+}
+
+void Binary_Operator::compile(Bytecode& code) const
+{
+  vector<Visit<const Expression_Tree>> work{{this, false}};
+  while (!work.empty())
+    {
+      auto visit = work.back();
+      work.pop_back();
+      auto op = as_binary(visit.node);
+      if (op == nullptr)
+        {
+          visit.node->compile(code);
+          continue;
+        }
+
+      auto assign = dynamic_cast<const Assign*>(op);
+      if (!visit.done)
+        {
+          // Ett delat delträd som redan beräknats hämtas från sin plats.
+          if (op->shared && code.recall(op))
+            {
+              continue;
+            }
+          // En tilldelning beräknar bara sitt högerled.
+          if (assign != nullptr && dynamic_cast<const Variable*>(op->leftop) == nullptr)
+            {
+              throw expression_tree_error {"no expression tree"};
+            }
+          work.push_back({op, true});
+          work.push_back({op->rightop, false});
+          if (assign == nullptr)
+            {
+              work.push_back({op->leftop, false});
+            }
+          continue;
+        }
+
+      if (assign != nullptr)
+        {
+          code.emit_store(op->leftop->str());
+        }
+      else
+        {
+          code.emit(op->opcode());
+        }
+      if (op->shared)
+        {
+          code.remember(op);
+        }
+    }
+}
+
+Expression_Tree* Binary_Operator::simplify(Node_Arena& arena)
+{
+  // Barnen förenklas före sin förälder, som sedan får de nya barnen.
+  vector<Expression_Tree*> results;
+  vector<Visit<Expression_Tree>> work{{this, false}};
+  while (!work.empty())
+    {
+      auto visit = work.back();
+      work.pop_back();
+      auto op = as_binary(visit.node);
+      if (op == nullptr)
+        {
+          results.push_back(visit.node->simplify(arena));
+        }
+      else if (!visit.done)
+        {
+          work.push_back({op, true});
+          work.push_back({op->rightop, false});
+          work.push_back({op->leftop, false});
+        }
+      else
+        {
+          op->rightop = results.back();
+          results.pop_back();
+          op->leftop = results.back();
+          results.back() = op->simplify_node(arena);
+        }
+    }
+  return results.back();
+}
+
+Expression_Tree* Binary_Operator::simplify_node(Node_Arena& arena)
+{
+  return fold(arena);
+}
+
+Expression_Tree* Binary_Operator::share(Subtree_Table& table)
+{
+  vector<Expression_Tree*> results;
+  vector<Visit<Expression_Tree>> work{{this, false}};
+  while (!work.empty())
+    {
+      auto visit = work.back();
+      work.pop_back();
+      auto op = as_binary(visit.node);
+      if (op == nullptr)
+        {
+          results.push_back(visit.node->share(table));
+          continue;
+        }
+
+      auto assign = dynamic_cast<Assign*>(op);
+      if (!visit.done)
+        {
+          work.push_back({op, true});
+          work.push_back({op->rightop, false});
+          if (assign == nullptr)
+            {
+              work.push_back({op->leftop, false});
+            }
+          continue;
+        }
+
+      op->rightop = results.back();
+      results.pop_back();
+      if (assign != nullptr)
+        {
+          // Delträd före och efter tilldelningen kan läsa olika värden på
+          // variabeln och får därför inte slås ihop.
+          table.clear();
+          results.push_back(op);
+        }
+      else
+        {
+          op->leftop = results.back();
+          results.back() = table.intern(op, op->leftop, op->rightop);
+        }
+    }
+  return results.back();
+}
+
+Expression_Tree* Binary_Operator::fold(Node_Arena& arena)
+{
+  // Ett delträd med bara konstanter ersätts av sitt värde. Division med noll
+  // lämnas kvar så att felet uppstår vid utvärderingen, som tidigare.
+  if (!is_constant(leftop) || !is_constant(rightop))
+    {
+      return this;
+    }
+  if (dynamic_cast<Divide*>(this) != nullptr && rightop->evaluate() == 0)
+    {
+      return this;
+    }
+
+  long double value{evaluate()};
+  if (dynamic_cast<Integer*>(leftop) != nullptr && dynamic_cast<Integer*>(rightop) != nullptr &&
+      value == trunc(value) && fabs(value) < 9.2e18L)
+    {
+      return arena.make<Integer>(static_cast<long long int>(value));
+    }
+  return arena.make<Real>(value);
+}
+
 std::string Operand::get_postfix()  const 
   {
     return str();
@@ -26,8 +632,19 @@ std::string Operand::get_postfix()  const
 
 void Operand::print(std::ostream& os, int counter) const
   {
-    os << std::setw(++counter) << str() << '\n';
+    Stream_Sink sink{os};
+    ::write_tree(this, sink, counter);
   }
+
+Expression_Tree* Operand::simplify(Node_Arena&)
+{
+  return this;
+}
+
+Expression_Tree* Operand::share(Subtree_Table& table)
+{
+  return table.intern(this);
+}
   
 
 long double Integer::evaluate() const 
@@ -40,9 +657,21 @@ std::string Integer::str() const
   return std::to_string (number);
 }
 
-Integer* Integer::clone() const 
+std::string_view Integer::token(Token_Buffer& scratch) const
+{
+  auto result = std::to_chars(scratch.data(), scratch.data() + scratch.size(), number);
+  return std::string_view(scratch.data(), result.ptr - scratch.data());
+}
+
+Integer* Integer::clone(Node_Arena* arena) const 
+{
+  EXPRESSION_COUNT(cloned_nodes, 1);
+  return make_node<Integer>(arena, number);
+}
+
+void Integer::compile(Bytecode& code) const
 {
-  return new Integer{number};
+  code.emit_constant(number);
 }
 
 long double Real::evaluate() const 
@@ -52,15 +681,27 @@ long double Real::evaluate() const
 
 std::string Real::str() const 
 {
-  stringstream sst;
-  sst << decimal;
-  return sst.str();
+  Token_Buffer scratch;
+  return std::string{token(scratch)};
+}
+
+std::string_view Real::token(Token_Buffer& scratch) const
+{
+  // Samma format som en ström med standardinställningar (%g, 6 siffror).
+  int length{std::snprintf(scratch.data(), scratch.size(), "%Lg", decimal)};
+  return std::string_view(scratch.data(), static_cast<std::size_t>(length));
 }
   
 
-Real* Real::clone() const 
+Real* Real::clone(Node_Arena* arena) const 
 {
-  return new Real{decimal};
+  EXPRESSION_COUNT(cloned_nodes, 1);
+  return make_node<Real>(arena, decimal);
+}
+
+void Real::compile(Bytecode& code) const
+{
+  code.emit_constant(decimal);
 }
 
 long double Variable::evaluate() const 
@@ -72,6 +713,11 @@ std::string Variable::str() const
 {
   return variabel;
 }
+
+std::string_view Variable::token(Token_Buffer&) const
+{
+  return variabel;
+}
    
 long double Variable::get_value() const
 {
@@ -83,16 +729,19 @@ void Variable::set_value(long double val)
   value = val;
 }
 
-Variable* Variable::clone() const
+Variable* Variable::clone(Node_Arena* arena) const
 {
-  return new Variable{variabel, value};
+  EXPRESSION_COUNT(cloned_nodes, 1);
+  return make_node<Variable>(arena, variabel, value);
 }
 
-long double Assign::evaluate() const 
+void Variable::compile(Bytecode& code) const
 {
-  long double op;
-  op = rightop->evaluate();
+  code.emit_load(variabel, value);
+}
 
+long double Assign::apply(long double, long double right) const
+{
   Variable* point;
   point = dynamic_cast<Variable*>(leftop); 
 
@@ -102,8 +751,8 @@ long double Assign::evaluate() const
     }
   else
     {
-      point->set_value(op); 
-      return op;
+      point->set_value(right); 
+      return right;
     }
 }
 
@@ -113,18 +762,24 @@ std::string Assign::str() const
 }
  
 
-Assign* Assign::clone() const 
+Assign* Assign::clone(Node_Arena* arena) const 
 {
-  Expression_Tree* newleft = leftop->clone();
-  Expression_Tree* newright = rightop->clone();
-  return new Assign{newleft, newright};
+  return static_cast<Assign*>(clone_tree(arena));
 }
 
-long double Plus::evaluate() const
+Assign* Assign::copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const
 {
-  long double op;
-  op = leftop->evaluate() + rightop->evaluate();
-  return op;
+  return make_node<Assign>(arena, left, right);
+}
+
+Opcode Assign::opcode() const
+{
+  return Opcode::store_variable;
+}
+
+long double Plus::apply(long double left, long double right) const
+{
+  return left + right;
 }
 
 std::string Plus::str() const 
@@ -133,18 +788,37 @@ std::string Plus::str() const
 }
 
 
-Plus* Plus::clone() const 
+Plus* Plus::clone(Node_Arena* arena) const
+{
+  return static_cast<Plus*>(clone_tree(arena));
+}
+
+Plus* Plus::copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const
 {
-  Expression_Tree* newleft = leftop->clone();
-  Expression_Tree* newright = rightop->clone();
-  return new Plus{newleft, newright};
+  return make_node<Plus>(arena, left, right);
 }
 
-long double Minus::evaluate() const 
+Opcode Plus::opcode() const
 {
-  long double op;
-  op = leftop->evaluate() - rightop->evaluate();
-  return op;
+  return Opcode::add;
+}
+
+Expression_Tree* Plus::simplify_node(Node_Arena& arena)
+{
+  if (is_constant(leftop, 0) && !is_constant(rightop))
+    {
+      return rightop;
+    }
+  if (is_constant(rightop, 0) && !is_constant(leftop))
+    {
+      return leftop;
+    }
+  return fold(arena);
+}
+
+long double Minus::apply(long double left, long double right) const
+{
+  return left - right;
 }
 
 std::string Minus::str() const 
@@ -153,18 +827,33 @@ std::string Minus::str() const
 }
 
 
-Minus* Minus::clone() const
+Minus* Minus::clone(Node_Arena* arena) const
 {
-  Expression_Tree* newleft = leftop->clone();
-  Expression_Tree* newright = rightop->clone();
-  return new Minus{newleft, newright};
+  return static_cast<Minus*>(clone_tree(arena));
 }
 
-long double Times::evaluate() const
-  {
-  long double op;
-  op = leftop->evaluate() * rightop->evaluate();
-  return op;
+Minus* Minus::copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const
+{
+  return make_node<Minus>(arena, left, right);
+}
+
+Opcode Minus::opcode() const
+{
+  return Opcode::subtract;
+}
+
+Expression_Tree* Minus::simplify_node(Node_Arena& arena)
+{
+  if (is_constant(rightop, 0) && !is_constant(leftop))
+    {
+      return leftop;
+    }
+  return fold(arena);
+}
+
+long double Times::apply(long double left, long double right) const
+{
+  return left * right;
 }
 
 std::string Times::str() const
@@ -172,24 +861,43 @@ std::string Times::str() const
   return "*";
 }
 
-Times* Times::clone() const 
+Times* Times::clone(Node_Arena* arena) const
 {
-  Expression_Tree* newleft = leftop->clone();
-  Expression_Tree* newright = rightop->clone();
-  return new Times{newleft, newright};
+  return static_cast<Times*>(clone_tree(arena));
+}
+
+Times* Times::copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const
+{
+  return make_node<Times>(arena, left, right);
+}
+
+Opcode Times::opcode() const
+{
+  return Opcode::multiply;
+}
+
+Expression_Tree* Times::simplify_node(Node_Arena& arena)
+{
+  if (is_constant(leftop, 1) && !is_constant(rightop))
+    {
+      return rightop;
+    }
+  if (is_constant(rightop, 1) && !is_constant(leftop))
+    {
+      return leftop;
+    }
+  return fold(arena);
 }
 
-long double Divide::evaluate() const 
+long double Divide::apply(long double left, long double right) const
 {
-  long double op;
-  if (rightop->evaluate() == 0)
+  if (right == 0)
     {
       throw expression_tree_error {"do not divide by zero"};
     }
   else
     {
-      op = leftop->evaluate() / rightop->evaluate();
-      return op;
+      return left / right;
     }
 }
 
@@ -198,18 +906,33 @@ std::string Divide::str() const
   return "/";
 }
 
-Divide* Divide::clone() const 
+Divide* Divide::clone(Node_Arena* arena) const
+{
+  return static_cast<Divide*>(clone_tree(arena));
+}
+
+Divide* Divide::copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const
+{
+  return make_node<Divide>(arena, left, right);
+}
+
+Opcode Divide::opcode() const
 {
-  Expression_Tree* newleft = leftop->clone();
-  Expression_Tree* newright = rightop->clone();
-  return new Divide{newleft, newright};
+  return Opcode::divide;
+}
+
+Expression_Tree* Divide::simplify_node(Node_Arena& arena)
+{
+  if (is_constant(rightop, 1) && !is_constant(leftop))
+    {
+      return leftop;
+    }
+  return fold(arena);
 }
 
-long double Power::evaluate() const 
+long double Power::apply(long double left, long double right) const
 {
-  long double op;
-  op = pow(leftop->evaluate(), rightop->evaluate());
-  return op;
+  return pow(left, right);
 }
 
 std::string Power::str() const
@@ -217,9 +940,31 @@ std::string Power::str() const
   return "^";
 }
 
-Power* Power::clone() const
+Power* Power::clone(Node_Arena* arena) const
 {
-  Expression_Tree* newleft = leftop->clone();
-  Expression_Tree* newright = rightop->clone();
-  return new Power{newleft, newright};
+  return static_cast<Power*>(clone_tree(arena));
+}
+
+Power* Power::copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const
+{
+  return make_node<Power>(arena, left, right);
+}
+
+Opcode Power::opcode() const
+{
+  return Opcode::power;
+}
+
+Expression_Tree* Power::simplify_node(Node_Arena& arena)
+{
+  if (is_constant(rightop, 1) && !is_constant(leftop))
+    {
+      return leftop;
+    }
+  // x^2 blir x*x när x är en variabel, så att inget delträd dupliceras.
+  if (is_constant(rightop, 2) && dynamic_cast<Variable*>(leftop) != nullptr)
+    {
+      return arena.make<Times>(leftop, leftop->clone(&arena));
+    }
+  return fold(arena);
 }
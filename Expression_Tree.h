@@ -3,13 +3,21 @@
  */
 #ifndef EXPRESSIONTREE_H
 #define EXPRESSIONTREE_H
+#include <array>
 #include <iosfwd>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <cmath>
 #include <iostream>
 #include <iomanip>
+#include <cstdint>
+
+class Bytecode;
+class Node_Arena;
+class Subtree_Table;
+enum class Opcode : std::uint8_t;
 
 class expression_tree_error : public std::logic_error
   {
@@ -29,30 +37,97 @@ class expression_tree_error : public std::logic_error
 class Expression_Tree
 {
 public:
+  // Utrymme för en nods text när den inte finns lagrad i noden, t.ex. ett
+  // formaterat tal.
+  using Token_Buffer = std::array<char, 48>;
+
   virtual long double      evaluate() const = 0;
   virtual std::string      str() const = 0;
+  // Samma text som str(), utan allokering: pekar in i noden eller i scratch.
+  virtual std::string_view token(Token_Buffer& scratch) const = 0;
   virtual std::string      get_postfix() const = 0;
   virtual void             print(std::ostream&, int counter=3) const = 0;
-  virtual Expression_Tree* clone() const = 0;
+  virtual Expression_Tree* clone(Node_Arena* arena = nullptr) const = 0;
+  virtual void             compile(Bytecode&) const = 0;
+  // Förenklar delträdet i arenan och returnerar den nod som ersätter det.
+  virtual Expression_Tree* simplify(Node_Arena& arena) = 0;
+  // Ersätter delträdet med en redan sedd, strukturellt lika nod om en sådan
+  // finns, så att trädet blir en DAG. Kräver att noderna ligger i en arena.
+  virtual Expression_Tree* share(Subtree_Table& table) = 0;
   virtual ~Expression_Tree() = default;
+
+  // Skriver delträdet i postfix- eller infixform, eller som träd (samma
+  // utseende som print), i ett linjärt svep direkt till en ström eller sist
+  // i en buffert som kan återanvändas mellan anropen. Infixformen har bara
+  // de parenteser som behövs för att läsas in till samma träd igen.
+  void write_postfix(std::ostream& os) const;
+  void write_postfix(std::string& buffer) const;
+  void write_infix(std::ostream& os) const;
+  void write_infix(std::string& buffer) const;
+  void write_tree(std::ostream& os) const;
+  void write_tree(std::string& buffer) const;
+
+protected:
+  // Noder i en Node_Arena förstörs av arenan, inte av sin förälder.
+  bool in_arena{false};
+  // Noden har flera föräldrar och beräknas bara en gång per utvärdering.
+  bool shared{false};
+  // Noden är en Binary_Operator; låter genomgångarna undvika dynamic_cast.
+  bool binary{false};
+
+private:
+  friend class Binary_Operator;
+  friend class Node_Arena;
+  friend class Subtree_Table;
 };
 
 class Binary_Operator : public Expression_Tree
 {
 public:
+  // Alla genomgångar av ett delträd görs med en egen stack i stället för
+  // rekursion, så att trädets djup bara begränsas av minnet.
+  long double evaluate() const override;
 
   void print(std::ostream& os, int counter=3) const override;
 
   std::string get_postfix() const override;
 
+  std::string_view token(Token_Buffer& scratch) const override;
+
+  void compile(Bytecode&) const override;
+
+  Expression_Tree* simplify(Node_Arena& arena) override;
+
+  Expression_Tree* share(Subtree_Table& table) override;
+
+  virtual Opcode opcode() const = 0;
+
+  const Expression_Tree* left() const { return leftop; }
+  const Expression_Tree* right() const { return rightop; }
+
+  // Noden som Binary_Operator, eller nullptr om den är en operand.
+  static const Binary_Operator* as_binary(const Expression_Tree* node);
+
 protected:
 
-  ~Binary_Operator() 
+  ~Binary_Operator();
+  Binary_Operator (Expression_Tree* number1, Expression_Tree* number2) : leftop{number1}, rightop{number2}
   {
-    delete leftop;
-    delete rightop;
-  };
-  Binary_Operator (Expression_Tree* number1, Expression_Tree* number2) : leftop{number1}, rightop{number2} {}
+    binary = true;
+  }
+
+  // Operatorns eget steg, givet operandernas värden respektive nya barn.
+  virtual long double      apply(long double left, long double right) const = 0;
+  virtual Binary_Operator* copy(Node_Arena* arena,
+                                Expression_Tree* left, Expression_Tree* right) const = 0;
+  // Förenklar noden när barnen redan är förenklade.
+  virtual Expression_Tree* simplify_node(Node_Arena& arena);
+
+  static Binary_Operator* as_binary(Expression_Tree* node);
+
+  Binary_Operator* clone_tree(Node_Arena* arena) const;
+  Expression_Tree* fold(Node_Arena& arena);
+
   Expression_Tree* leftop{};
   Expression_Tree* rightop{};
 
@@ -70,6 +145,10 @@ public:
 
   void print(std::ostream& os, int counter=3) const override;
 
+  Expression_Tree* simplify(Node_Arena& arena) override;
+
+  Expression_Tree* share(Subtree_Table& table) override;
+
 protected:
   Operand() noexcept = default;
   ~Operand() = default;
@@ -92,7 +171,11 @@ public:
 
   std::string str() const override;
 
-  Integer* clone() const override;
+  std::string_view token(Token_Buffer& scratch) const override;
+
+  Integer* clone(Node_Arena* arena = nullptr) const override;
+
+  void compile(Bytecode&) const override;
 
 protected:
   Integer() noexcept = default;
@@ -117,7 +200,11 @@ public:
 
   std::string str() const override;
 
-  Real* clone() const override;
+  std::string_view token(Token_Buffer& scratch) const override;
+
+  Real* clone(Node_Arena* arena = nullptr) const override;
+
+  void compile(Bytecode&) const override;
 
 protected:
   Real() noexcept = default;
@@ -139,11 +226,15 @@ public:
 
   std::string str() const override;
 
+  std::string_view token(Token_Buffer& scratch) const override;
+
   long double get_value() const;
 
   void set_value(long double val);
 
-  Variable* clone() const override;
+  Variable* clone(Node_Arena* arena = nullptr) const override;
+
+  void compile(Bytecode&) const override;
 
 protected:
   Variable() noexcept = default;
@@ -163,11 +254,16 @@ class Assign : public Binary_Operator
 public:
   Assign (Expression_Tree* leftop, Expression_Tree* rightop) : Binary_Operator{leftop, rightop} {}
 
-  long double evaluate() const override;
-
   std::string str() const override;
 
-  Assign* clone() const override;
+  Assign* clone(Node_Arena* arena = nullptr) const override;
+
+  Opcode opcode() const override;
+
+protected:
+  long double apply(long double left, long double right) const override;
+
+  Assign* copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const override;
 
 private:
   Assign& operator =(const Assign&) = delete;
@@ -182,11 +278,18 @@ class Plus : public Binary_Operator
 public:
   Plus (Expression_Tree* leftop, Expression_Tree* rightop) : Binary_Operator{leftop, rightop} {}
   
-  long double evaluate() const override;
-
   std::string str() const override;
 
-  Plus* clone() const override;
+  Plus* clone(Node_Arena* arena = nullptr) const override;
+
+  Opcode opcode() const override;
+
+protected:
+  long double apply(long double left, long double right) const override;
+
+  Plus* copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const override;
+
+  Expression_Tree* simplify_node(Node_Arena& arena) override;
 
 private:
   Plus& operator =(const Plus&) = delete;
@@ -201,11 +304,18 @@ class Minus : public Binary_Operator
 public:
   Minus (Expression_Tree* leftop, Expression_Tree* rightop) : Binary_Operator{leftop, rightop} {}
   
-  long double evaluate() const override;
-
   std::string str() const override;
 
-  Minus* clone() const override;
+  Minus* clone(Node_Arena* arena = nullptr) const override;
+
+  Opcode opcode() const override;
+
+protected:
+  long double apply(long double left, long double right) const override;
+
+  Minus* copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const override;
+
+  Expression_Tree* simplify_node(Node_Arena& arena) override;
 
 private:
   Minus& operator =(const Minus&) = delete;
@@ -220,11 +330,18 @@ class Times : public Binary_Operator
 public:
   Times (Expression_Tree* leftop, Expression_Tree* rightop) : Binary_Operator{leftop, rightop} {}
   
-  long double evaluate() const override;
-
   std::string str() const override;
 
-  Times* clone() const override;
+  Times* clone(Node_Arena* arena = nullptr) const override;
+
+  Opcode opcode() const override;
+
+protected:
+  long double apply(long double left, long double right) const override;
+
+  Times* copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const override;
+
+  Expression_Tree* simplify_node(Node_Arena& arena) override;
 
 private:
   Times& operator =(const Times&) = delete;
@@ -239,11 +356,18 @@ class Divide : public Binary_Operator
 public:
   Divide (Expression_Tree* leftop, Expression_Tree* rightop) : Binary_Operator{leftop, rightop} {}
   
-  long double evaluate() const override;
-
   std::string str() const override;
 
-  Divide* clone() const override;
+  Divide* clone(Node_Arena* arena = nullptr) const override;
+
+  Opcode opcode() const override;
+
+protected:
+  long double apply(long double left, long double right) const override;
+
+  Divide* copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const override;
+
+  Expression_Tree* simplify_node(Node_Arena& arena) override;
 
 private:
   Divide& operator =(const Divide&) = delete;
@@ -258,11 +382,18 @@ class Power: public Binary_Operator
 public:
   Power (Expression_Tree* leftop, Expression_Tree* rightop) : Binary_Operator{leftop, rightop} {}
   
-  long double evaluate() const override;
-
   std::string str() const override;
 
-  Power* clone() const override;
+  Power* clone(Node_Arena* arena = nullptr) const override;
+
+  Opcode opcode() const override;
+
+protected:
+  long double apply(long double left, long double right) const override;
+
+  Power* copy(Node_Arena* arena, Expression_Tree* left, Expression_Tree* right) const override;
+
+  Expression_Tree* simplify_node(Node_Arena& arena) override;
 
 private:
   Power& operator =(const Power&) = delete;
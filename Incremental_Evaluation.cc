@@ -0,0 +1,232 @@
+/*
+ * Incremental_Evaluation.cc
+ */
+#include "Incremental_Evaluation.h"
+#include "Expression_Tree.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace
+{
+  constexpr std::uint32_t none{numeric_limits<std::uint32_t>::max()};
+
+  // Gör om en lista av (källa, mål)-par till kompakt form (offsets, mål).
+  void make_adjacency(vector<pair<std::uint32_t, std::uint32_t>>& edges, std::size_t count,
+                      vector<std::uint32_t>& offsets, vector<std::uint32_t>& targets)
+  {
+    sort(edges.begin(), edges.end());
+    offsets.assign(count + 1, 0);
+    targets.clear();
+    targets.reserve(edges.size());
+    for (const auto& edge : edges)
+      {
+        ++offsets[edge.first + 1];
+        targets.push_back(edge.second);
+      }
+    for (std::size_t i{0}; i < count; ++i)
+      {
+        offsets[i + 1] += offsets[i];
+      }
+  }
+}
+
+Incremental_Evaluation::Incremental_Evaluation(const Bytecode& program)
+  : symbols{program.symbol_table},
+    constants{program.constants},
+    values(program.code.size()),
+    environment{program.symbol_table.initial_values()}
+{
+  if (program.code.empty())
+    {
+      throw expression_tree_error {"no expression tree"};
+    }
+
+  // Stackmaskinen simuleras en gång för att ta reda på vilka steg som
+  // producerar varje instruktions operander.
+  vector<std::uint32_t> stack;
+  vector<std::uint32_t> writer(symbols.size(), none);
+  vector<std::uint32_t> saved(program.temporary_count, none);
+  vector<pair<std::uint32_t, std::uint32_t>> step_edges;
+  vector<pair<std::uint32_t, std::uint32_t>> slot_edges;
+
+  steps.reserve(program.code.size());
+  for (std::uint32_t i{0}; i < program.code.size(); ++i)
+    {
+      const Instruction& instruction{program.code[i]};
+      Step step{instruction.op, instruction.arg, none, none};
+
+      switch (instruction.op)
+        {
+        case Opcode::push_constant:
+          stack.push_back(i);
+          break;
+        case Opcode::load_variable:
+          // En läsning efter en tilldelning i uttrycket beror på tilldelningen.
+          if (writer[instruction.arg] != none)
+            {
+              step.left = writer[instruction.arg];
+            }
+          else
+            {
+              slot_edges.emplace_back(instruction.arg, i);
+            }
+          stack.push_back(i);
+          break;
+        case Opcode::store_variable:
+          step.left = stack.back();
+          stack.back() = i;
+          writer[instruction.arg] = i;
+          break;
+        case Opcode::save_temporary:
+          step.left = stack.back();
+          stack.back() = i;
+          saved[instruction.arg] = i;
+          break;
+        case Opcode::load_temporary:
+          step.left = saved[instruction.arg];
+          stack.push_back(i);
+          break;
+        default:
+          step.right = stack.back();
+          stack.pop_back();
+          step.left = stack.back();
+          stack.back() = i;
+          break;
+        }
+
+      if (step.left != none)
+        {
+          step_edges.emplace_back(step.left, i);
+        }
+      if (step.right != none)
+        {
+          step_edges.emplace_back(step.right, i);
+        }
+      steps.push_back(step);
+    }
+  root = stack.back();
+  assigned = std::move(writer);
+
+  make_adjacency(step_edges, steps.size(), dependent_offsets, dependents);
+  make_adjacency(slot_edges, symbols.size(), reader_offsets, readers);
+
+  // Första utvärderingen räknar ut alla steg.
+  dirty.assign(steps.size(), true);
+  pending.resize(steps.size());
+  for (std::uint32_t i{0}; i < steps.size(); ++i)
+    {
+      pending[i] = i;
+    }
+}
+
+void Incremental_Evaluation::set(std::size_t slot, long double value)
+{
+  if (environment.at(slot) == value)
+    {
+      return;
+    }
+
+  environment[slot] = value;
+  for (std::uint32_t r{reader_offsets[slot]}; r < reader_offsets[slot + 1]; ++r)
+    {
+      mark(readers[r]);
+    }
+}
+
+void Incremental_Evaluation::set(std::string_view name, long double value)
+{
+  std::size_t slot{symbols.slot(name)};
+  if (slot == Symbol_Table::npos)
+    {
+      throw expression_tree_error {"no variable " + std::string{name}};
+    }
+  set(slot, value);
+}
+
+long double Incremental_Evaluation::get(std::size_t slot) const
+{
+  // En variabel som tilldelas i uttrycket har tilldelningens värde.
+  if (assigned.at(slot) != none)
+    {
+      return values[assigned[slot]];
+    }
+  return environment[slot];
+}
+
+void Incremental_Evaluation::mark(std::size_t step)
+{
+  // Markerar steget och allt som beror på det; redan markerade steg har
+  // redan fått sina beroende markerade.
+  vector<std::uint32_t> work{static_cast<std::uint32_t>(step)};
+  while (!work.empty())
+    {
+      std::uint32_t current{work.back()};
+      work.pop_back();
+      if (dirty[current])
+        {
+          continue;
+        }
+
+      dirty[current] = true;
+      pending.push_back(current);
+      for (std::uint32_t d{dependent_offsets[current]}; d < dependent_offsets[current + 1]; ++d)
+        {
+          work.push_back(dependents[d]);
+        }
+    }
+}
+
+long double Incremental_Evaluation::compute(const Step& step) const
+{
+  switch (step.op)
+    {
+    case Opcode::push_constant:
+      return constants[step.arg];
+    case Opcode::load_variable:
+      return step.left != none ? values[step.left] : environment[step.arg];
+    case Opcode::store_variable:
+    case Opcode::save_temporary:
+    case Opcode::load_temporary:
+      return values[step.left];
+    case Opcode::add:
+      return values[step.left] + values[step.right];
+    case Opcode::subtract:
+      return values[step.left] - values[step.right];
+    case Opcode::multiply:
+      return values[step.left] * values[step.right];
+    case Opcode::divide:
+      if (values[step.right] == 0)
+        {
+          throw expression_tree_error {"do not divide by zero"};
+        }
+      return values[step.left] / values[step.right];
+    case Opcode::power:
+      return pow(values[step.left], values[step.right]);
+    }
+  return 0;
+}
+
+long double Incremental_Evaluation::evaluate()
+{
+  // Operanderna kommer alltid före sina användare i programmet, så stegen
+  // räknas om i stigande ordning. Kastas ett undantag ligger alla kvar som
+  // markerade till nästa anrop.
+  sort(pending.begin(), pending.end());
+  for (std::uint32_t i : pending)
+    {
+      values[i] = compute(steps[i]);
+    }
+
+  for (std::uint32_t i : pending)
+    {
+      dirty[i] = false;
+    }
+  pending.clear();
+
+  return values[root];
+}
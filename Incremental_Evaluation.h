@@ -0,0 +1,61 @@
+/*
+ * Incremental_Evaluation.h
+ */
+#ifndef INCREMENTAL_EVALUATION_H
+#define INCREMENTAL_EVALUATION_H
+#include "Bytecode.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/**
+ * Incremental_Evaluation: Utvärdering som sparar värdet av varje delträd
+ * mellan anropen. När en variabel ändras markeras bara vägen från dess
+ * läsningar upp till roten, och evaluate() räknar om just de stegen.
+ * Miljön innehåller bara indata: en tilldelning i uttrycket skriver inte
+ * över variabelns indata, men get() ger tilldelningens värde.
+ */
+class Incremental_Evaluation
+{
+public:
+  explicit Incremental_Evaluation(const Bytecode& program);
+
+  void        set(std::size_t slot, long double value);
+  void        set(std::string_view name, long double value);
+  long double get(std::size_t slot) const;
+  long double evaluate();
+
+private:
+  // Ett steg per instruktion; left och right är index för operandernas steg.
+  struct Step
+  {
+    Opcode        op;
+    std::uint32_t arg;
+    std::uint32_t left;
+    std::uint32_t right;
+  };
+
+  void        mark(std::size_t step);
+  long double compute(const Step& step) const;
+
+  Symbol_Table             symbols;
+  std::vector<long double> constants;
+  std::vector<Step>        steps;
+  std::vector<long double> values;
+  std::vector<long double> environment;
+
+  // Beroenden lagrade kompakt: dependents[dependent_offsets[i]..[i+1]) är de
+  // steg som läser värdet av steg i, readers motsvarande för variabelplatser.
+  std::vector<std::uint32_t> dependent_offsets;
+  std::vector<std::uint32_t> dependents;
+  std::vector<std::uint32_t> reader_offsets;
+  std::vector<std::uint32_t> readers;
+
+  std::vector<bool>          dirty;
+  std::vector<std::uint32_t> pending;
+  std::uint32_t              root{0};
+  std::vector<std::uint32_t> assigned;
+};
+
+#endif
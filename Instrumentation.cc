@@ -0,0 +1,220 @@
+/*
+ * Instrumentation.cc
+ */
+#include "Instrumentation.h"
+#include <algorithm>
+#include <ostream>
+
+#ifdef EXPRESSION_INSTRUMENTATION
+#include <atomic>
+#include <mutex>
+#include <vector>
+#endif
+
+using namespace std;
+
+namespace instrumentation
+{
+#ifdef EXPRESSION_INSTRUMENTATION
+  namespace
+  {
+    // En tråds räknare. Bara tråden själv ökar dem, men snapshot() och
+    // reset() läser och skriver från andra trådar; därför atomära med
+    // relaxed ordning, som inte kostar mer än vanliga variabler.
+    struct Counters
+    {
+      atomic<uint64_t> phase_calls[phase_count]{};
+      atomic<uint64_t> phase_nanoseconds[phase_count]{};
+      atomic<uint64_t> expressions{0};
+      atomic<uint64_t> nodes{0};
+      atomic<uint64_t> max_nodes{0};
+      atomic<uint64_t> max_depth{0};
+      atomic<uint64_t> counters[counter_count]{};   // index är Counter
+      atomic<uint64_t> operations[opcode_count]{};
+    };
+
+    void increase(atomic<uint64_t>& value, uint64_t amount) noexcept
+    {
+      value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+
+    void raise(atomic<uint64_t>& value, uint64_t candidate) noexcept
+    {
+      if (candidate > value.load(memory_order_relaxed))
+        {
+          value.store(candidate, memory_order_relaxed);
+        }
+    }
+
+    void accumulate(Snapshot& sum, const Counters& c)
+    {
+      for (std::size_t i{0}; i < phase_count; ++i)
+        {
+          sum.phase_calls[i] += c.phase_calls[i].load(memory_order_relaxed);
+          sum.phase_nanoseconds[i] += c.phase_nanoseconds[i].load(memory_order_relaxed);
+        }
+      sum.expressions += c.expressions.load(memory_order_relaxed);
+      sum.nodes += c.nodes.load(memory_order_relaxed);
+      sum.max_nodes = max(sum.max_nodes, c.max_nodes.load(memory_order_relaxed));
+      sum.max_depth = max(sum.max_depth, c.max_depth.load(memory_order_relaxed));
+      auto counter = [&c](Counter counter)
+      {
+        return c.counters[static_cast<std::size_t>(counter)].load(memory_order_relaxed);
+      };
+      sum.evaluations += counter(Counter::evaluations);
+      sum.allocations += counter(Counter::allocations);
+      sum.allocated_bytes += counter(Counter::allocated_bytes);
+      sum.clones += counter(Counter::clones);
+      sum.cloned_nodes += counter(Counter::cloned_nodes);
+      for (std::size_t i{0}; i < opcode_count; ++i)
+        {
+          sum.operations[i] += c.operations[i].load(memory_order_relaxed);
+        }
+    }
+
+    void clear(Counters& c)
+    {
+      for (auto& value : c.phase_calls)       value.store(0, memory_order_relaxed);
+      for (auto& value : c.phase_nanoseconds) value.store(0, memory_order_relaxed);
+      for (auto& value : c.counters)          value.store(0, memory_order_relaxed);
+      for (auto& value : c.operations)        value.store(0, memory_order_relaxed);
+      c.expressions.store(0, memory_order_relaxed);
+      c.nodes.store(0, memory_order_relaxed);
+      c.max_nodes.store(0, memory_order_relaxed);
+      c.max_depth.store(0, memory_order_relaxed);
+    }
+
+    // Levande trådars räknare, samt summan för trådar som avslutats.
+    struct Registry
+    {
+      mutex              lock;
+      vector<Counters*>  threads;
+      Snapshot           finished;
+    };
+
+    Registry& registry()
+    {
+      // Avsiktligt aldrig förstörd: trådar kan avslutas efter main().
+      static Registry* instance{new Registry};
+      return *instance;
+    }
+
+    struct Thread_Counters
+    {
+      Counters counters;
+
+      Thread_Counters()
+      {
+        Registry&        r{registry()};
+        lock_guard<mutex> guard{r.lock};
+        r.threads.push_back(&counters);
+      }
+
+      ~Thread_Counters()
+      {
+        Registry&        r{registry()};
+        lock_guard<mutex> guard{r.lock};
+        accumulate(r.finished, counters);
+        r.threads.erase(find(r.threads.begin(), r.threads.end(), &counters));
+      }
+    };
+
+    Counters& local() noexcept
+    {
+      thread_local Thread_Counters counters;
+      return counters.counters;
+    }
+  }
+
+  Snapshot snapshot()
+  {
+    Registry&        r{registry()};
+    lock_guard<mutex> guard{r.lock};
+    Snapshot         sum{r.finished};
+    for (const Counters* counters : r.threads)
+      {
+        accumulate(sum, *counters);
+      }
+    return sum;
+  }
+
+  void reset()
+  {
+    Registry&        r{registry()};
+    lock_guard<mutex> guard{r.lock};
+    r.finished = Snapshot{};
+    for (Counters* counters : r.threads)
+      {
+        clear(*counters);
+      }
+  }
+
+  void add(Counter counter, uint64_t amount) noexcept
+  {
+    increase(local().counters[static_cast<std::size_t>(counter)], amount);
+  }
+
+  void add_phase(Phase phase, uint64_t nanoseconds) noexcept
+  {
+    Counters& c{local()};
+    increase(c.phase_calls[static_cast<std::size_t>(phase)], 1);
+    increase(c.phase_nanoseconds[static_cast<std::size_t>(phase)], nanoseconds);
+  }
+
+  void add_operations(const uint64_t* per_opcode) noexcept
+  {
+    Counters& c{local()};
+    increase(c.counters[static_cast<std::size_t>(Counter::evaluations)], 1);
+    for (std::size_t i{0}; i < opcode_count; ++i)
+      {
+        if (per_opcode[i] != 0)
+          {
+            increase(c.operations[i], per_opcode[i]);
+          }
+      }
+  }
+
+  void add_expression(uint64_t nodes, uint64_t depth) noexcept
+  {
+    Counters& c{local()};
+    increase(c.expressions, 1);
+    increase(c.nodes, nodes);
+    raise(c.max_nodes, nodes);
+    raise(c.max_depth, depth);
+  }
+#else
+  Snapshot snapshot()
+  {
+    return Snapshot{};
+  }
+
+  void reset() {}
+  void add(Counter, uint64_t) noexcept {}
+  void add_phase(Phase, uint64_t) noexcept {}
+  void add_operations(const uint64_t*) noexcept {}
+  void add_expression(uint64_t, uint64_t) noexcept {}
+#endif
+
+  void write(std::ostream& os, const Snapshot& s)
+  {
+    static const char* const phases[phase_count]{"parse", "simplify", "share", "compile"};
+    static const char* const opcodes[opcode_count]{
+      "push_constant", "load_variable", "store_variable", "add", "subtract",
+      "multiply", "divide", "power", "save_temporary", "load_temporary"};
+
+    for (std::size_t i{0}; i < phase_count; ++i)
+      {
+        os << "phase." << phases[i] << ": " << s.phase_calls[i] << " calls, "
+           << s.phase_nanoseconds[i] << " ns\n";
+      }
+    os << "expressions: " << s.expressions << ", nodes: " << s.nodes
+       << ", max_nodes: " << s.max_nodes << ", max_depth: " << s.max_depth << '\n'
+       << "evaluations: " << s.evaluations << '\n';
+    for (std::size_t i{0}; i < opcode_count; ++i)
+      {
+        os << "operations." << opcodes[i] << ": " << s.operations[i] << '\n';
+      }
+    os << "allocations: " << s.allocations << ", bytes: " << s.allocated_bytes << '\n'
+       << "clones: " << s.clones << ", cloned_nodes: " << s.cloned_nodes << '\n';
+  }
+}
@@ -0,0 +1,120 @@
+/*
+ * Instrumentation.h
+ */
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+
+/**
+ * instrumentation: Räknare och tider inne i biblioteket, för att se var
+ * tiden går utan att koppla in en profilerare:
+ *   - tid och antal anrop per fas när ett uttryck skapas (tolkning,
+ *     förenkling, delning av delträd, kompilering),
+ *   - antal noder och träddjup för varje skapat Expression,
+ *   - utvärderingar och utförda steg per operation (Opcode),
+ *   - allokeringar av noder och arenablock, antal och byte,
+ *   - anrop av clone() och antal klonade noder.
+ *
+ * Räknarna finns bara när biblioteket byggs med EXPRESSION_INSTRUMENTATION
+ * definierat (make INSTRUMENTATION=1). Annars expanderar makrona nedan till
+ * ingenting och snapshot() ger bara nollor. Varje tråd räknar i sitt eget
+ * minne; snapshot() summerar alla trådar, även avslutade.
+ */
+namespace instrumentation
+{
+#ifdef EXPRESSION_INSTRUMENTATION
+  constexpr bool enabled{true};
+#else
+  constexpr bool enabled{false};
+#endif
+
+  enum class Phase : std::uint8_t
+  {
+    parse,
+    simplify,
+    share,
+    compile
+  };
+
+  constexpr std::size_t phase_count{4};
+  constexpr std::size_t opcode_count{10};   // som Opcode i Bytecode.h
+
+  enum class Counter : std::uint8_t
+  {
+    evaluations,
+    allocations,
+    allocated_bytes,
+    clones,
+    cloned_nodes
+  };
+
+  constexpr std::size_t counter_count{5};
+
+  struct Snapshot
+  {
+    std::uint64_t phase_calls[phase_count]{};
+    std::uint64_t phase_nanoseconds[phase_count]{};
+    std::uint64_t expressions{0};
+    std::uint64_t nodes{0};                  // summan över alla uttryck
+    std::uint64_t max_nodes{0};
+    std::uint64_t max_depth{0};
+    std::uint64_t evaluations{0};
+    std::uint64_t operations[opcode_count]{};   // index är Opcode
+    std::uint64_t allocations{0};
+    std::uint64_t allocated_bytes{0};
+    std::uint64_t clones{0};
+    std::uint64_t cloned_nodes{0};
+  };
+
+  Snapshot snapshot();
+  // Nollställer alla trådars räknare. Räkningar som pågår samtidigt kan
+  // hamna före eller efter nollställningen.
+  void     reset();
+  // En rad per räknare, läsbar för människor.
+  void     write(std::ostream& os, const Snapshot& snapshot);
+
+  // Anropas via makrona nedan.
+  void add(Counter counter, std::uint64_t amount) noexcept;
+  void add_phase(Phase phase, std::uint64_t nanoseconds) noexcept;
+  void add_operations(const std::uint64_t* per_opcode) noexcept;
+  void add_expression(std::uint64_t nodes, std::uint64_t depth) noexcept;
+
+  // Mäter tiden till slutet av sitt block.
+  class Phase_Timer
+  {
+  public:
+    explicit Phase_Timer(Phase phase) noexcept
+      : phase{phase}, start{std::chrono::steady_clock::now()} {}
+
+    ~Phase_Timer()
+    {
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      add_phase(phase, static_cast<std::uint64_t>(
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+  private:
+    Phase                                 phase;
+    std::chrono::steady_clock::time_point start;
+
+    Phase_Timer(const Phase_Timer&) = delete;
+    Phase_Timer& operator =(const Phase_Timer&) = delete;
+  };
+}
+
+#ifdef EXPRESSION_INSTRUMENTATION
+#define EXPRESSION_COUNT(counter, amount) \
+  ::instrumentation::add(::instrumentation::Counter::counter, (amount))
+#define EXPRESSION_TIME_PHASE(phase) \
+  ::instrumentation::Phase_Timer expression_phase_timer{::instrumentation::Phase::phase}
+#define EXPRESSION_ONLY(...) __VA_ARGS__
+#else
+#define EXPRESSION_COUNT(counter, amount) ((void)0)
+#define EXPRESSION_TIME_PHASE(phase) ((void)0)
+#define EXPRESSION_ONLY(...)
+#endif
+
+#endif
@@ -0,0 +1,738 @@
+/*
+ * Native_Function.cc
+ */
+#include "Native_Function.h"
+#include "Expression_Tree.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define NATIVE_FUNCTION_X86_64 1
+#endif
+
+using namespace std;
+
+namespace
+{
+  // xmm0 .. xmm13 håller stackmaskinens stack; xmm14 och xmm15 är arbets-
+  // register. Djupare program utvärderas av tolken.
+  constexpr int register_count{14};
+  constexpr int scratch{14};
+  constexpr int zero{15};
+
+  // Största heltalsexponent som räknas ut med multiplikationer.
+  constexpr long double max_exponent{64};
+
+  bool small_exponent(long double value)
+  {
+    return value >= 0 && value <= max_exponent && value == trunc(value);
+  }
+
+  enum class Base { rdi, rsp };
+
+  /*
+   * Assembler: Lägger ut de få x86-64-instruktioner som behövs, med
+   * konstanter i en pool efter koden som läses RIP-relativt.
+   */
+  class Assembler
+  {
+  public:
+    std::size_t size() const { return bytes.size(); }
+    const vector<std::uint8_t>& code() const { return bytes; }
+
+    void byte(std::uint8_t b) { bytes.push_back(b); }
+
+    void dword(std::uint32_t value)
+    {
+      for (int i{0}; i < 4; ++i)
+        {
+          byte(static_cast<std::uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    // Register-register: prefix [REX] 0F op modrm.
+    void sse(std::uint8_t prefix, std::uint8_t op, int reg, int rm)
+    {
+      byte(prefix);
+      rex(false, reg >= 8, false, rm >= 8);
+      byte(0x0f);
+      byte(op);
+      byte(static_cast<std::uint8_t>(0xc0 | (reg & 7) << 3 | (rm & 7)));
+    }
+
+    // Minne [base + disp32], base är rdi eller rsp.
+    void sse(std::uint8_t prefix, std::uint8_t op, int reg, Base base, std::int32_t disp)
+    {
+      byte(prefix);
+      rex(false, reg >= 8, false, false);
+      byte(0x0f);
+      byte(op);
+      if (base == Base::rdi)
+        {
+          byte(static_cast<std::uint8_t>(0x80 | (reg & 7) << 3 | 7));
+        }
+      else
+        {
+          byte(static_cast<std::uint8_t>(0x80 | (reg & 7) << 3 | 4));
+          byte(0x24);
+        }
+      dword(static_cast<std::uint32_t>(disp));
+    }
+
+    // Minne [base + r8], base är rax (0) eller rsi (6).
+    void sse_indexed(std::uint8_t prefix, std::uint8_t op, int reg, int base)
+    {
+      byte(prefix);
+      rex(false, reg >= 8, true, false);
+      byte(0x0f);
+      byte(op);
+      byte(static_cast<std::uint8_t>((reg & 7) << 3 | 4));
+      byte(static_cast<std::uint8_t>(base));
+    }
+
+    // Minne [rip + disp32] till en konstant i poolen.
+    void sse_constant(std::uint8_t prefix, std::uint8_t op, int reg, std::size_t index)
+    {
+      byte(prefix);
+      rex(false, reg >= 8, false, false);
+      byte(0x0f);
+      byte(op);
+      byte(static_cast<std::uint8_t>((reg & 7) << 3 | 5));
+      constant_fixups.emplace_back(size(), index);
+      dword(0);
+    }
+
+    // Hopp med 32-bitars avstånd till en etikett som sätts senare.
+    void jump(std::uint8_t condition, vector<std::size_t>& fixups)
+    {
+      byte(0x0f);
+      byte(condition);
+      fixups.push_back(size());
+      dword(0);
+    }
+
+    void jump_to(std::uint8_t condition, std::size_t target)
+    {
+      byte(0x0f);
+      byte(condition);
+      dword(static_cast<std::uint32_t>(static_cast<std::int32_t>(target - (size() + 4))));
+    }
+
+    void bind(const vector<std::size_t>& fixups)
+    {
+      for (std::size_t at : fixups)
+        {
+          patch(at, static_cast<std::int32_t>(size() - (at + 4)));
+        }
+    }
+
+    void adjust_stack(std::uint8_t op, std::uint32_t amount)
+    {
+      if (amount != 0)
+        {
+          byte(0x48);
+          byte(0x81);
+          byte(op);
+          dword(amount);
+        }
+    }
+
+    // Konstantpoolen läggs efter koden, 16-byte-justerad, med varje värde
+    // två gånger så att det även kan läsas som ett packat par.
+    void finish(const vector<double>& pool)
+    {
+      while (size() % 16 != 0)
+        {
+          byte(0xcc);
+        }
+      std::size_t start{size()};
+      for (double value : pool)
+        {
+          std::uint8_t raw[8];
+          memcpy(raw, &value, sizeof raw);
+          for (int copy{0}; copy < 2; ++copy)
+            {
+              bytes.insert(bytes.end(), raw, raw + 8);
+            }
+        }
+      for (const auto& fixup : constant_fixups)
+        {
+          patch(fixup.first,
+                static_cast<std::int32_t>(start + 16 * fixup.second - (fixup.first + 4)));
+        }
+    }
+
+  private:
+    void rex(bool w, bool r, bool x, bool b)
+    {
+      std::uint8_t value{static_cast<std::uint8_t>(0x40 | w << 3 | r << 2 | x << 1 | b)};
+      if (value != 0x40)
+        {
+          byte(value);
+        }
+    }
+
+    void patch(std::size_t at, std::int32_t value)
+    {
+      for (int i{0}; i < 4; ++i)
+        {
+          bytes[at + i] = static_cast<std::uint8_t>(static_cast<std::uint32_t>(value) >> (8 * i));
+        }
+    }
+
+    vector<std::uint8_t>                       bytes;
+    vector<pair<std::size_t, std::size_t>>     constant_fixups;
+  };
+
+  // SSE-operationer; prefixet väljer skalär (F2, sd) eller packad (66, pd) form.
+  constexpr std::uint8_t scalar_prefix{0xf2};
+  constexpr std::uint8_t packed_prefix{0x66};
+  constexpr std::uint8_t load_op{0x10};
+  constexpr std::uint8_t store_op{0x11};
+  constexpr std::uint8_t move_op{0x28};
+  constexpr std::uint8_t add_op{0x58};
+  constexpr std::uint8_t multiply_op{0x59};
+  constexpr std::uint8_t subtract_op{0x5c};
+  constexpr std::uint8_t divide_op{0x5e};
+  constexpr std::uint8_t xor_op{0x57};
+  constexpr std::uint8_t jump_equal{0x84};
+  constexpr std::uint8_t jump_not_equal{0x85};
+
+  /*
+   * Translator: Översätter programmet till en skalär funktion
+   *   double f(const double* variables, int* status)
+   * och en packad funktion för två rader åt gången
+   *   void g(const double* const* columns, double* result, size_t pairs, int* status).
+   * Division med noll sätter *status och avbryter.
+   */
+  class Translator
+  {
+  public:
+    Translator(const vector<Instruction>& code, const vector<long double>& constants,
+               std::size_t temporary_count, std::size_t variable_count)
+      : code{code}, constants{constants}, temporary_count{temporary_count},
+        stored_slot(variable_count, none)
+    {
+    }
+
+    // Returnerar false om programmet inte kan översättas.
+    bool translate()
+    {
+      if (!check())
+        {
+          return false;
+        }
+
+      frame_size = 16 * (temporary_count + stored_count);
+      // Ramen läses bara med ojusterade instruktioner och behöver därför
+      // inte 16-byte-justeras.
+      scalar_entry = assembler.size();
+      emit_scalar();
+      batch_entry = assembler.size();
+      emit_batch();
+      assembler.finish(pool);
+      return true;
+    }
+
+    const vector<std::uint8_t>& machine_code() const { return assembler.code(); }
+    std::size_t                 scalar_offset() const { return scalar_entry; }
+    std::size_t                 batch_offset() const { return batch_entry; }
+
+  private:
+    static constexpr std::size_t none{static_cast<std::size_t>(-1)};
+
+    // Går igenom programmet en gång: kontrollerar stackdjup och potenser
+    // och ger varje tilldelad variabel en plats i ramen.
+    bool check()
+    {
+      int depth{0};
+      for (std::size_t i{0}; i < code.size(); ++i)
+        {
+          const Instruction& instruction{code[i]};
+          switch (instruction.op)
+            {
+            case Opcode::push_constant:
+              if (exponent_at(i + 1))
+                {
+                  continue;
+                }
+              [[fallthrough]];
+            case Opcode::load_variable:
+            case Opcode::load_temporary:
+              ++depth;
+              break;
+            case Opcode::store_variable:
+              if (stored_slot[instruction.arg] == none)
+                {
+                  stored_slot[instruction.arg] = temporary_count + stored_count++;
+                }
+              break;
+            case Opcode::power:
+              if (!exponent_at(i))
+                {
+                  return false;
+                }
+              break;
+            case Opcode::save_temporary:
+              break;
+            default:
+              --depth;
+              break;
+            }
+          if (depth > register_count)
+            {
+              return false;
+            }
+        }
+      return true;
+    }
+
+    // Sant om instruktionen på plats i är en potens vars exponent är en
+    // liten heltalskonstant direkt före.
+    bool exponent_at(std::size_t i) const
+    {
+      return i < code.size() && i > 0 && code[i].op == Opcode::power &&
+        code[i - 1].op == Opcode::push_constant && small_exponent(constants[code[i - 1].arg]);
+    }
+
+    std::size_t constant(double value)
+    {
+      for (std::size_t i{0}; i < pool.size(); ++i)
+        {
+          if (memcmp(&pool[i], &value, sizeof value) == 0)
+            {
+              return i;
+            }
+        }
+      pool.push_back(value);
+      return pool.size() - 1;
+    }
+
+    void emit_scalar()
+    {
+      vector<std::size_t> failures;
+      assembler.adjust_stack(0xec, static_cast<std::uint32_t>(frame_size));
+      emit_body(false, failures);
+      assembler.adjust_stack(0xc4, static_cast<std::uint32_t>(frame_size));
+      assembler.byte(0xc3);                               // ret
+
+      // Division med noll: *status = 1 och 0 som resultat.
+      assembler.bind(failures);
+      for (std::uint8_t b : {0xc7, 0x06, 0x01, 0x00, 0x00, 0x00})
+        {
+          assembler.byte(b);                              // mov dword [rsi], 1
+        }
+      assembler.sse(packed_prefix, xor_op, 0, 0);
+      assembler.adjust_stack(0xc4, static_cast<std::uint32_t>(frame_size));
+      assembler.byte(0xc3);
+    }
+
+    void emit_batch()
+    {
+      vector<std::size_t> failures;
+      vector<std::size_t> done;
+      assembler.adjust_stack(0xec, static_cast<std::uint32_t>(frame_size));
+      for (std::uint8_t b : {0x45, 0x31, 0xc0})           // xor r8d, r8d
+        {
+          assembler.byte(b);
+        }
+      for (std::uint8_t b : {0x48, 0x85, 0xd2})           // test rdx, rdx
+        {
+          assembler.byte(b);
+        }
+      assembler.jump(jump_equal, done);
+
+      std::size_t loop{assembler.size()};
+      emit_body(true, failures);
+      assembler.sse_indexed(packed_prefix, store_op, 0, 6);  // movupd [rsi + r8], xmm0
+      for (std::uint8_t b : {0x49, 0x83, 0xc0, 0x10})     // add r8, 16
+        {
+          assembler.byte(b);
+        }
+      for (std::uint8_t b : {0x48, 0xff, 0xca})           // dec rdx
+        {
+          assembler.byte(b);
+        }
+      assembler.jump_to(jump_not_equal, loop);
+
+      assembler.bind(done);
+      assembler.adjust_stack(0xc4, static_cast<std::uint32_t>(frame_size));
+      assembler.byte(0xc3);
+
+      assembler.bind(failures);
+      for (std::uint8_t b : {0xc7, 0x01, 0x01, 0x00, 0x00, 0x00})
+        {
+          assembler.byte(b);                              // mov dword [rcx], 1
+        }
+      assembler.adjust_stack(0xc4, static_cast<std::uint32_t>(frame_size));
+      assembler.byte(0xc3);
+    }
+
+    void emit_body(bool packed, vector<std::size_t>& failures)
+    {
+      const std::uint8_t prefix{packed ? packed_prefix : scalar_prefix};
+      vector<bool> stored(stored_slot.size(), false);
+      int top{0};
+
+      for (std::size_t i{0}; i < code.size(); ++i)
+        {
+          const Instruction& instruction{code[i]};
+          switch (instruction.op)
+            {
+            case Opcode::push_constant:
+              if (exponent_at(i + 1))
+                {
+                  break;
+                }
+              assembler.sse_constant(prefix, load_op, top++,
+                                     constant(static_cast<double>(constants[instruction.arg])));
+              break;
+            case Opcode::load_variable:
+              if (stored[instruction.arg])
+                {
+                  load_frame(prefix, top++, stored_slot[instruction.arg]);
+                }
+              else if (packed)
+                {
+                  // mov rax, [rdi + 8 * slot]; movupd xmm, [rax + r8]
+                  assembler.byte(0x48);
+                  assembler.byte(0x8b);
+                  assembler.byte(0x87);
+                  assembler.dword(static_cast<std::uint32_t>(8 * instruction.arg));
+                  assembler.sse_indexed(packed_prefix, load_op, top++, 0);
+                }
+              else
+                {
+                  assembler.sse(scalar_prefix, load_op, top++, Base::rdi,
+                                static_cast<std::int32_t>(8 * instruction.arg));
+                }
+              break;
+            case Opcode::store_variable:
+              stored[instruction.arg] = true;
+              store_frame(prefix, top - 1, stored_slot[instruction.arg]);
+              break;
+            case Opcode::save_temporary:
+              store_frame(prefix, top - 1, instruction.arg);
+              break;
+            case Opcode::load_temporary:
+              load_frame(prefix, top++, instruction.arg);
+              break;
+            case Opcode::add:
+              --top;
+              assembler.sse(prefix, add_op, top - 1, top);
+              break;
+            case Opcode::subtract:
+              --top;
+              assembler.sse(prefix, subtract_op, top - 1, top);
+              break;
+            case Opcode::multiply:
+              --top;
+              assembler.sse(prefix, multiply_op, top - 1, top);
+              break;
+            case Opcode::divide:
+              --top;
+              check_divisor(packed, top, failures);
+              assembler.sse(prefix, divide_op, top - 1, top);
+              break;
+            case Opcode::power:
+              emit_power(prefix, top - 1, constants[code[i - 1].arg]);
+              break;
+            }
+        }
+    }
+
+    void load_frame(std::uint8_t prefix, int reg, std::size_t slot)
+    {
+      assembler.sse(prefix, load_op, reg, Base::rsp, static_cast<std::int32_t>(16 * slot));
+    }
+
+    void store_frame(std::uint8_t prefix, int reg, std::size_t slot)
+    {
+      assembler.sse(prefix, store_op, reg, Base::rsp, static_cast<std::int32_t>(16 * slot));
+    }
+
+    // Hoppar till felhanteringen om divisorn (i någon rad) är exakt noll.
+    // Ett NaN räknas inte som noll, som i tolken.
+    void check_divisor(bool packed, int divisor, vector<std::size_t>& failures)
+    {
+      assembler.sse(packed_prefix, xor_op, zero, zero);   // xorpd xmm15, xmm15
+      if (packed)
+        {
+          assembler.sse(packed_prefix, 0xc2, zero, divisor);  // cmppd xmm15, xmm, eq
+          assembler.byte(0x00);
+          assembler.sse(packed_prefix, 0x50, 0, zero);    // movmskpd eax, xmm15
+          assembler.byte(0x85);                           // test eax, eax
+          assembler.byte(0xc0);
+          assembler.jump(jump_not_equal, failures);
+        }
+      else
+        {
+          assembler.sse(packed_prefix, 0x2e, divisor, zero);  // ucomisd xmm, xmm15
+          assembler.byte(0x7a);                           // jp +6 (NaN)
+          assembler.byte(0x06);
+          assembler.jump(jump_equal, failures);
+        }
+    }
+
+    // x^n för ett litet heltal n, med kvadrering och multiplikation.
+    void emit_power(std::uint8_t prefix, int base, long double exponent)
+    {
+      auto n = static_cast<unsigned>(exponent);
+      if (n == 0)
+        {
+          assembler.sse_constant(prefix, load_op, base, constant(1.0));
+          return;
+        }
+
+      // scratch = resultat, zero = base^(2^k); zero används inte av divisionen
+      // förrän potensen är klar.
+      bool have_result{false};
+      assembler.sse(packed_prefix, move_op, zero, base);
+      while (n != 0)
+        {
+          if (n & 1)
+            {
+              if (have_result)
+                {
+                  assembler.sse(prefix, multiply_op, scratch, zero);
+                }
+              else
+                {
+                  assembler.sse(packed_prefix, move_op, scratch, zero);
+                  have_result = true;
+                }
+            }
+          n >>= 1;
+          if (n != 0)
+            {
+              assembler.sse(prefix, multiply_op, zero, zero);
+            }
+        }
+      assembler.sse(packed_prefix, move_op, base, scratch);
+    }
+
+    const vector<Instruction>& code;
+    const vector<long double>& constants;
+    std::size_t                temporary_count;
+    std::size_t                stored_count{0};
+    vector<std::size_t>        stored_slot;
+    std::size_t                frame_size{0};
+    vector<double>             pool;
+    Assembler                  assembler;
+    std::size_t                scalar_entry{0};
+    std::size_t                batch_entry{0};
+  };
+
+#ifdef NATIVE_FUNCTION_X86_64
+  void write_perf_map(const void* start, std::size_t size, const std::string& name)
+  {
+    static mutex            perf_mutex;
+    static const char*      enabled{getenv("EXPRESSION_PERF_MAP")};
+    if (enabled == nullptr || *enabled == '\0')
+      {
+        return;
+      }
+
+    lock_guard<mutex> lock{perf_mutex};
+    string path{"/tmp/perf-" + to_string(getpid()) + ".map"};
+    if (FILE* file = fopen(path.c_str(), "a"))
+      {
+        fprintf(file, "%lx %zx %s\n", reinterpret_cast<unsigned long>(start), size,
+                name.c_str());
+        fclose(file);
+      }
+  }
+#endif
+}
+
+Native_Function::Native_Function(const Bytecode& program, std::string_view name)
+  : program{program}
+{
+  if (program.code.empty())
+    {
+      throw expression_tree_error {"no expression tree"};
+    }
+
+#ifdef NATIVE_FUNCTION_X86_64
+  Translator translator{program.code, program.constants, program.temporary_count,
+                        program.symbol_table.size()};
+  if (!translator.translate())
+    {
+      return;
+    }
+
+  const vector<std::uint8_t>& bytes{translator.machine_code()};
+  long        page{sysconf(_SC_PAGESIZE)};
+  std::size_t size{(bytes.size() + page - 1) / page * page};
+  void*       pages{mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)};
+  if (pages == MAP_FAILED)
+    {
+      return;
+    }
+
+  // Sidorna är aldrig skrivbara och exekverbara samtidigt.
+  memcpy(pages, bytes.data(), bytes.size());
+  if (mprotect(pages, size, PROT_READ | PROT_EXEC) != 0)
+    {
+      munmap(pages, size);
+      return;
+    }
+
+  memory = pages;
+  memory_size = size;
+  auto base = static_cast<std::uint8_t*>(pages);
+  scalar = reinterpret_cast<Scalar_Entry>(base + translator.scalar_offset());
+  batch = reinterpret_cast<Batch_Entry>(base + translator.batch_offset());
+
+  string symbol{"expression::" + string{name}};
+  write_perf_map(base + translator.scalar_offset(),
+                 translator.batch_offset() - translator.scalar_offset(), symbol);
+  write_perf_map(base + translator.batch_offset(),
+                 bytes.size() - translator.batch_offset(), symbol + " [batch]");
+#else
+  static_cast<void>(name);
+#endif
+}
+
+Native_Function::~Native_Function()
+{
+  release();
+}
+
+Native_Function::Native_Function(Native_Function&& other) noexcept
+  : program{}, memory{other.memory}, memory_size{other.memory_size},
+    scalar{other.scalar}, batch{other.batch}
+{
+  program.swap(other.program);
+  other.memory = nullptr;
+  other.memory_size = 0;
+  other.scalar = nullptr;
+  other.batch = nullptr;
+}
+
+Native_Function& Native_Function::operator =(Native_Function&& other) noexcept
+{
+  if (this != &other)
+    {
+      release();
+      program.swap(other.program);
+      std::swap(memory, other.memory);
+      std::swap(memory_size, other.memory_size);
+      std::swap(scalar, other.scalar);
+      std::swap(batch, other.batch);
+    }
+  return *this;
+}
+
+void Native_Function::release() noexcept
+{
+#ifdef NATIVE_FUNCTION_X86_64
+  if (memory != nullptr)
+    {
+      munmap(memory, memory_size);
+    }
+#endif
+  memory = nullptr;
+  memory_size = 0;
+  scalar = nullptr;
+  batch = nullptr;
+}
+
+double Native_Function::operator ()(const double* variables) const
+{
+  if (scalar != nullptr)
+    {
+      int    status{0};
+      double value{scalar(variables, &status)};
+      if (status != 0)
+        {
+          throw expression_tree_error {"do not divide by zero"};
+        }
+      return value;
+    }
+
+  if (program.empty())
+    {
+      throw expression_tree_error {"no expression tree"};
+    }
+
+  // Tolken räknar också i double; kopian gör att tilldelningar inte syns
+  // i indata.
+  vector<double> environment(variables, variables + program.symbol_table.size());
+  return program.run(environment.data());
+}
+
+void Native_Function::run_batch(const Column_Map& columns, double* result,
+                                std::size_t rows) const
+{
+  if (batch == nullptr)
+    {
+      program.run_batch(columns, result, rows);
+      return;
+    }
+
+  // Kolumnerna ordnas efter plats. En variabel som läses innan den
+  // tilldelas måste ha en kolumn, som i tolken.
+  const Symbol_Table&   symbols{program.symbol_table};
+  vector<const double*> sources(symbols.size(), nullptr);
+  vector<bool>          stored(symbols.size(), false);
+  for (const Instruction& instruction : program.code)
+    {
+      if (instruction.op == Opcode::store_variable)
+        {
+          stored[instruction.arg] = true;
+        }
+      else if (instruction.op == Opcode::load_variable && !stored[instruction.arg] &&
+               sources[instruction.arg] == nullptr)
+        {
+          auto it = columns.find(symbols.name(instruction.arg));
+          if (it == columns.end())
+            {
+              throw expression_tree_error {"no column for variable " +
+                                           symbols.name(instruction.arg)};
+            }
+          sources[instruction.arg] = it->second;
+        }
+    }
+
+  int status{0};
+  batch(sources.data(), result, rows / 2, &status);
+
+  // En udda sista rad räknas med den skalära funktionen.
+  if (status == 0 && rows % 2 != 0)
+    {
+      vector<double> variables(symbols.size(), 0.0);
+      for (std::size_t slot{0}; slot < sources.size(); ++slot)
+        {
+          if (sources[slot] != nullptr)
+            {
+              variables[slot] = sources[slot][rows - 1];
+            }
+        }
+      result[rows - 1] = scalar(variables.data(), &status);
+    }
+
+  if (status != 0)
+    {
+      throw expression_tree_error {"do not divide by zero"};
+    }
+}
+
+bool Native_Function::native() const
+{
+  return scalar != nullptr;
+}
+
+std::size_t Native_Function::variable_count() const
+{
+  return program.symbol_table.size();
+}
@@ -0,0 +1,55 @@
+/*
+ * Native_Function.h
+ */
+#ifndef NATIVE_FUNCTION_H
+#define NATIVE_FUNCTION_H
+#include "Bytecode.h"
+#include <cstddef>
+#include <string_view>
+
+/**
+ * Native_Function: Ett program översatt till x86-64-maskinkod (SSE2, double)
+ * i egna exekverbara sidor. Stackmaskinens stack läggs i xmm-register, och
+ * satsvis utvärdering räknar två rader åt gången med packade instruktioner.
+ *
+ * Program som inte kan översättas (potenser med annat än en liten heltals-
+ * exponent, stackdjup över registren, eller en annan plattform) utvärderas
+ * i stället av tolken; native() talar om vilket som gäller. Tilldelningar i
+ * uttrycket syns bara i resultatet, indata ändras aldrig.
+ *
+ * Är miljövariabeln EXPRESSION_PERF_MAP satt skrivs funktionernas adresser
+ * till /tmp/perf-<pid>.map så att perf kan visa dem med namn.
+ */
+class Native_Function
+{
+public:
+  explicit Native_Function(const Bytecode& program, std::string_view name = "expression");
+  ~Native_Function();
+
+  Native_Function(Native_Function&& other) noexcept;
+  Native_Function& operator =(Native_Function&& other) noexcept;
+
+  // variables har ett värde per plats i programmets symboltabell.
+  double      operator ()(const double* variables) const;
+  void        run_batch(const Column_Map& columns, double* result, std::size_t rows) const;
+  bool        native() const;
+  std::size_t variable_count() const;
+
+private:
+  using Scalar_Entry = double (*)(const double* variables, int* status);
+  using Batch_Entry  = void (*)(const double* const* columns, double* result,
+                                std::size_t pairs, int* status);
+
+  void release() noexcept;
+
+  Bytecode     program;
+  void*        memory{nullptr};
+  std::size_t  memory_size{0};
+  Scalar_Entry scalar{nullptr};
+  Batch_Entry  batch{nullptr};
+
+  Native_Function(const Native_Function&) = delete;
+  Native_Function& operator =(const Native_Function&) = delete;
+};
+
+#endif
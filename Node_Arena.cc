@@ -0,0 +1,76 @@
+/*
+ * Node_Arena.cc
+ */
+#include "Node_Arena.h"
+#include <cstdint>
+#include <new>
+
+using namespace std;
+
+Node_Arena::Node_Arena(std::size_t block_size)
+  : next_block_size{sizeof(Block) + (block_size < sizeof(Block) * 8 ? sizeof(Block) * 8 : block_size)}
+{
+}
+
+Node_Arena::~Node_Arena()
+{
+  // Noderna ansvarar inte för sina barn när de ligger i en arena, så varje
+  // nod förstörs för sig, utan rekursion.
+  for (Node_Record* record{nodes}; record != nullptr; record = record->next)
+    {
+      record->node->~Expression_Tree();
+    }
+
+  while (blocks != nullptr)
+    {
+      Block* next{blocks->next};
+      ::operator delete(blocks);
+      blocks = next;
+    }
+}
+
+std::size_t Node_Arena::bytes_used() const
+{
+  return used;
+}
+
+void Node_Arena::add_block(std::size_t minimum_size)
+{
+  std::size_t size{next_block_size};
+  while (size < minimum_size + sizeof(Block))
+    {
+      size *= 2;
+    }
+
+  Block* block{static_cast<Block*>(::operator new(size))};
+  EXPRESSION_COUNT(allocations, 1);
+  EXPRESSION_COUNT(allocated_bytes, size);
+  block->next = blocks;
+  block->size = size;
+  blocks = block;
+
+  current = reinterpret_cast<char*>(block) + sizeof(Block);
+  limit = reinterpret_cast<char*>(block) + size;
+  if (size < max_block_size)
+    {
+      next_block_size = size * 2;
+    }
+}
+
+void* Node_Arena::allocate(std::size_t size, std::size_t alignment)
+{
+  auto address = reinterpret_cast<std::uintptr_t>(current);
+  std::size_t padding{(alignment - address % alignment) % alignment};
+
+  if (current == nullptr || static_cast<std::size_t>(limit - current) < padding + size)
+    {
+      add_block(size + alignment);
+      address = reinterpret_cast<std::uintptr_t>(current);
+      padding = (alignment - address % alignment) % alignment;
+    }
+
+  void* memory{current + padding};
+  current += padding + size;
+  used += padding + size;
+  return memory;
+}
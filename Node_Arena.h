@@ -0,0 +1,86 @@
+/*
+ * Node_Arena.h
+ */
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+#include "Expression_Tree.h"
+#include "Instrumentation.h"
+#include <cstddef>
+#include <new>
+#include <utility>
+
+/**
+ * Node_Arena: Minnesområde för noderna i ett uttrycksträd. Noderna läggs
+ * tätt efter varandra i ett fåtal stora block och frigörs tillsammans när
+ * arenan förstörs, i stället för en new och en delete per nod.
+ */
+class Node_Arena
+{
+public:
+  static constexpr std::size_t default_block_size{4096};
+  static constexpr std::size_t max_block_size{65536};
+
+  explicit Node_Arena(std::size_t block_size = default_block_size);
+  ~Node_Arena();
+
+  template <typename T, typename... Args>
+  T* make(Args&&... args);
+
+  std::size_t bytes_used() const;
+
+private:
+  struct Block
+  {
+    Block*      next;
+    std::size_t size;
+  };
+
+  struct Node_Record
+  {
+    Expression_Tree* node;
+    Node_Record*     next;
+  };
+
+  void* allocate(std::size_t size, std::size_t alignment);
+  void  add_block(std::size_t minimum_size);
+
+  Block*       blocks{nullptr};
+  char*        current{nullptr};
+  char*        limit{nullptr};
+  Node_Record* nodes{nullptr};
+  std::size_t  next_block_size{};
+  std::size_t  used{0};
+
+  Node_Arena& operator =(const Node_Arena&) = delete;
+  Node_Arena(const Node_Arena&) = delete;
+};
+
+template <typename T, typename... Args>
+T* Node_Arena::make(Args&&... args)
+{
+  void* record_memory{allocate(sizeof(Node_Record), alignof(Node_Record))};
+  void* node_memory{allocate(sizeof(T), alignof(T))};
+
+  T* node{new (node_memory) T{std::forward<Args>(args)...}};
+  Expression_Tree* base{node};
+  base->in_arena = true;
+  nodes = new (record_memory) Node_Record{base, nodes};
+  return node;
+}
+
+/**
+ * make_node: Skapar en nod i arenan om en sådan ges, annars med new.
+ */
+template <typename T, typename... Args>
+T* make_node(Node_Arena* arena, Args&&... args)
+{
+  if (arena == nullptr)
+    {
+      EXPRESSION_COUNT(allocations, 1);
+      EXPRESSION_COUNT(allocated_bytes, sizeof(T));
+      return new T{std::forward<Args>(args)...};
+    }
+  return arena->make<T>(std::forward<Args>(args)...);
+}
+
+#endif
@@ -0,0 +1,568 @@
+/*
+ * Static_Expression.h
+ */
+#ifndef STATIC_EXPRESSION_H
+#define STATIC_EXPRESSION_H
+#include "Expression.h"
+#include "Expression_Grammar.h"
+#include "Expression_Tree.h"
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <string>
+#include <string_view>
+
+/**
+ * Static_Expression: Ett infixuttryck som tolkas vid kompileringen, med
+ * samma grammatik och prioritetstabeller som make_expression. Trädet blir
+ * en typ (expression templates) vars evaluate() blir rak aritmetik utan
+ * allokering eller virtuella anrop. Syntaxfel ger kompileringsfel.
+ *
+ *   constexpr auto area{STATIC_EXPRESSION("b * h / 2")};
+ *   long double    value{area.evaluate(environment)};
+ *
+ * Variablerna får platser i samma ordning som i make_expression, och
+ * miljön kan vara vad som helst som indexeras med en plats, t.ex. en
+ * long double* eller en Environment. En potens med en heltalskonstant
+ * 0..64 som exponent räknas med multiplikationer; övriga potenser anropar
+ * std::pow och kan därför inte räknas ut vid kompileringen.
+ */
+namespace static_expression
+{
+  enum class Kind : unsigned char
+  {
+    constant, variable, add, subtract, multiply, divide, power, assign
+  };
+
+  struct Node
+  {
+    Kind             kind{Kind::constant};
+    long double      value{0};
+    std::string_view name{};
+    std::size_t      slot{0};
+    std::size_t      left{0};
+    std::size_t      right{0};
+    bool             assigned{false};   // vänsterled i en tilldelning
+  };
+
+  // Tolkningens resultat: noderna i den ordning de skapades (operander före
+  // sina operatorer) och variablernas namn i platsordning.
+  template<std::size_t Capacity>
+  struct Program
+  {
+    std::array<Node, Capacity>              nodes{};
+    std::size_t                             node_count{0};
+    std::size_t                             root{0};
+    std::array<std::string_view, Capacity>  variables{};
+    std::size_t                             variable_count{0};
+
+    constexpr std::size_t slot(std::string_view name) const
+    {
+      std::size_t i{0};
+      while (i < variable_count && variables[i] != name)
+        {
+          ++i;
+        }
+      return i;
+    }
+  };
+
+  // Parser: Samma precedensklättring som make_expression, med fasta
+  // arrayer i stället för en arena så att den kan köras vid kompileringen.
+  // Felmeddelandena är desamma.
+  template<std::size_t Capacity>
+  class Parser
+  {
+  public:
+    constexpr explicit Parser(std::string_view infix) : input{infix}
+    {
+      advance();
+    }
+
+    constexpr Program<Capacity> parse()
+    {
+      if (current.kind == Token_Kind::end)
+        {
+          throw expression_error {"tomt infixuttryck!\n"};
+        }
+
+      std::size_t root{parse_expression()};
+
+      if (current.kind == Token_Kind::right_paren)
+        {
+          throw expression_error {"vänsterparentes saknas\n"};
+        }
+
+      program.root = root;
+      assign_slots();
+      return program;
+    }
+
+  private:
+    enum class Token_Kind { end, operand, binary_operator, left_paren, right_paren };
+
+    struct Token
+    {
+      Token_Kind       kind{Token_Kind::end};
+      std::string_view text{};
+    };
+
+    struct Frame
+    {
+      std::size_t lhs{0};
+      char        op{'('};
+      int         min_priority{0};
+    };
+
+    constexpr void advance()
+    {
+      while (position < input.size() && expression_grammar::is_space(input[position]))
+        {
+          ++position;
+        }
+
+      if (position == input.size())
+        {
+          current = Token{Token_Kind::end, {}};
+          return;
+        }
+
+      std::size_t start{position};
+      char        c{input[position]};
+
+      if (expression_grammar::is_operator(c))
+        {
+          current = Token{Token_Kind::binary_operator, input.substr(start, 1)};
+          ++position;
+        }
+      else if (c == '(')
+        {
+          current = Token{Token_Kind::left_paren, input.substr(start, 1)};
+          ++position;
+        }
+      else if (c == ')')
+        {
+          current = Token{Token_Kind::right_paren, input.substr(start, 1)};
+          ++position;
+        }
+      else if (expression_grammar::is_operand_char(c))
+        {
+          while (position < input.size() && expression_grammar::is_operand_char(input[position]))
+            {
+              ++position;
+            }
+          current = Token{Token_Kind::operand, input.substr(start, position - start)};
+        }
+      else
+        {
+          throw expression_error {"otillåten symbol\n"};
+        }
+    }
+
+    constexpr std::size_t parse_expression()
+    {
+      std::array<Frame, Capacity> frames{};
+      std::size_t                 frame_count{0};
+      int                         min_priority{0};
+
+      while (true)
+        {
+          while (current.kind == Token_Kind::left_paren)
+            {
+              ++paren_count;
+              advance();
+              if (current.kind == Token_Kind::right_paren)
+                {
+                  throw expression_error {"tom parentes\n"};
+                }
+              frames[frame_count++] = Frame{0, '(', min_priority};
+              min_priority = 0;
+            }
+
+          std::size_t lhs{parse_operand()};
+
+          while (true)
+            {
+              if (current.kind == Token_Kind::operand || current.kind == Token_Kind::left_paren)
+                {
+                  throw expression_error {"operand där operator förväntades\n"};
+                }
+
+              if (current.kind == Token_Kind::binary_operator &&
+                  expression_grammar::input_priority(current.text.front()) > min_priority)
+                {
+                  char op{current.text.front()};
+                  if (op == '=')
+                    {
+                      if (assignment)
+                        {
+                          throw expression_error {"multipel tilldelning"};
+                        }
+                      assignment = true;
+                    }
+
+                  frames[frame_count++] = Frame{lhs, op, min_priority};
+                  min_priority = expression_grammar::stack_priority(op);
+                  advance();
+                  break;
+                }
+
+              if (frame_count == 0)
+                {
+                  return lhs;
+                }
+
+              Frame frame{frames[--frame_count]};
+              if (frame.op == '(')
+                {
+                  if (current.kind != Token_Kind::right_paren)
+                    {
+                      throw expression_error {"högerparentes saknas\n"};
+                    }
+                  --paren_count;
+                  advance();
+                }
+              else
+                {
+                  lhs = make_operator(frame.op, frame.lhs, lhs);
+                }
+              min_priority = frame.min_priority;
+            }
+        }
+    }
+
+    constexpr std::size_t parse_operand()
+    {
+      if (current.kind == Token_Kind::operand)
+        {
+          std::size_t operand{make_operand(current.text)};
+          advance();
+          return operand;
+        }
+      if (current.kind == Token_Kind::binary_operator)
+        {
+          throw expression_error {"operator där operand förväntades\n"};
+        }
+      if (current.kind == Token_Kind::right_paren && paren_count == 0)
+        {
+          throw expression_error {"vänsterparentes saknas\n"};
+        }
+      throw expression_error {"operator avslutar\n"};
+    }
+
+    constexpr std::size_t make_operand(std::string_view token)
+    {
+      std::size_t digits{0};
+      std::size_t points{0};
+      std::size_t letters{0};
+      for (char c : token)
+        {
+          digits += expression_grammar::is_digit(c);
+          points += c == '.';
+          letters += expression_grammar::is_letter(c);
+        }
+
+      Node node{};
+      if (digits == token.size())
+        {
+          node.value = parse_integer(token);
+        }
+      else if (digits + points == token.size() && points == 1 && token.size() > 1)
+        {
+          node.value = parse_real(token);
+        }
+      else if (letters == token.size())
+        {
+          node.kind = Kind::variable;
+          node.name = token;
+        }
+      else
+        {
+          throw expression_error {"otillåten symbol\n"};
+        }
+      return add(node);
+    }
+
+    // Som std::stoll: för stora heltal är otillåtna.
+    static constexpr long double parse_integer(std::string_view token)
+    {
+      constexpr unsigned long long limit{std::numeric_limits<long long>::max()};
+      unsigned long long value{0};
+      for (char c : token)
+        {
+          unsigned digit = c - '0';
+          if (value > (limit - digit) / 10)
+            {
+              throw expression_error {"otillåten symbol\n"};
+            }
+          value = 10 * value + digit;
+        }
+      return value;
+    }
+
+    // Siffrorna samlas till ett heltal som delas med en exakt tiopotens, så
+    // att värdet avrundas en gång, som med std::stold. Längre tal än så
+    // räknas siffra för siffra.
+    static constexpr long double parse_real(std::string_view token)
+    {
+      unsigned long long mantissa{0};
+      long double        value{0};
+      long double        scale{1};
+      std::size_t        significant{0};
+      bool               fraction{false};
+      for (char c : token)
+        {
+          if (c == '.')
+            {
+              fraction = true;
+              continue;
+            }
+          unsigned digit = c - '0';
+          mantissa = 10 * mantissa + digit;
+          value = 10 * value + digit;
+          significant += mantissa != 0;
+          if (fraction)
+            {
+              scale *= 10;
+            }
+        }
+      if (significant <= 19 && scale <= 1e27L)
+        {
+          return mantissa / scale;
+        }
+      return value / scale;
+    }
+
+    constexpr std::size_t make_operator(char op, std::size_t lhs, std::size_t rhs)
+    {
+      Node node{};
+      node.left = lhs;
+      node.right = rhs;
+      switch (op)
+        {
+        case '^':
+          node.kind = Kind::power;
+          break;
+        case '*':
+          node.kind = Kind::multiply;
+          break;
+        case '/':
+          node.kind = Kind::divide;
+          break;
+        case '+':
+          node.kind = Kind::add;
+          break;
+        case '-':
+          node.kind = Kind::subtract;
+          break;
+        default:
+          // Tilldelning till något annat än en variabel kan aldrig lyckas.
+          if (program.nodes[lhs].kind != Kind::variable)
+            {
+              throw expression_error {"tilldelning till annat än en variabel\n"};
+            }
+          program.nodes[lhs].assigned = true;
+          node.kind = Kind::assign;
+          node.name = program.nodes[lhs].name;
+          break;
+        }
+      return add(node);
+    }
+
+    constexpr std::size_t add(const Node& node)
+    {
+      program.nodes[program.node_count] = node;
+      return program.node_count++;
+    }
+
+    // Platserna delas ut i postfixordning, där en tilldelad variabel räknas
+    // först vid tilldelningen, som när trädet kompileras till bytekod.
+    constexpr void assign_slots()
+    {
+      for (std::size_t i{0}; i < program.node_count; ++i)
+        {
+          Node& node{program.nodes[i]};
+          if ((node.kind == Kind::variable && !node.assigned) || node.kind == Kind::assign)
+            {
+              node.slot = program.slot(node.name);
+              if (node.slot == program.variable_count)
+                {
+                  program.variables[program.variable_count++] = node.name;
+                }
+            }
+        }
+    }
+
+    std::string_view  input;
+    std::size_t       position{0};
+    Token             current{};
+    Program<Capacity> program{};
+    bool              assignment{false};
+    int               paren_count{0};
+  };
+
+  template<typename Source>
+  inline constexpr auto program{
+    Parser<Source::text().size() + 1>{Source::text()}.parse()};
+
+  template<unsigned Exponent>
+  constexpr long double power(long double base)
+  {
+    if constexpr (Exponent == 0)
+      {
+        return 1;
+      }
+    else if constexpr (Exponent == 1)
+      {
+        return base;
+      }
+    else
+      {
+        long double half{power<Exponent / 2>(base)};
+        if constexpr (Exponent % 2 == 0)
+          {
+            return half * half;
+          }
+        else
+          {
+            return half * half * base;
+          }
+      }
+  }
+
+  constexpr bool small_exponent(const Node& node)
+  {
+    return node.kind == Kind::constant && node.value >= 0 && node.value <= 64 &&
+      node.value == static_cast<unsigned>(node.value);
+  }
+
+  // Term: Noden på plats Index i uttrycket Source. Operanderna räknas ut
+  // från vänster till höger, som i tolken.
+  template<typename Source, std::size_t Index>
+  struct Term
+  {
+    static constexpr Node node{program<Source>.nodes[Index]};
+
+    template<typename Environment>
+    static constexpr long double evaluate(Environment& environment)
+    {
+      if constexpr (node.kind == Kind::constant)
+        {
+          return node.value;
+        }
+      else if constexpr (node.kind == Kind::variable)
+        {
+          return environment[node.slot];
+        }
+      else if constexpr (node.kind == Kind::assign)
+        {
+          long double value{Term<Source, node.right>::evaluate(environment)};
+          environment[node.slot] = value;
+          return value;
+        }
+      else if constexpr (node.kind == Kind::power &&
+                         small_exponent(program<Source>.nodes[node.right]))
+        {
+          constexpr auto exponent = static_cast<unsigned>(program<Source>.nodes[node.right].value);
+          return power<exponent>(Term<Source, node.left>::evaluate(environment));
+        }
+      else
+        {
+          long double left{Term<Source, node.left>::evaluate(environment)};
+          long double right{Term<Source, node.right>::evaluate(environment)};
+          if constexpr (node.kind == Kind::add)
+            {
+              return left + right;
+            }
+          else if constexpr (node.kind == Kind::subtract)
+            {
+              return left - right;
+            }
+          else if constexpr (node.kind == Kind::multiply)
+            {
+              return left * right;
+            }
+          else if constexpr (node.kind == Kind::divide)
+            {
+              if (right == 0)
+                {
+                  throw expression_tree_error {"do not divide by zero"};
+                }
+              return left / right;
+            }
+          else
+            {
+              return std::pow(left, right);
+            }
+        }
+    }
+  };
+
+  [[noreturn]] inline void no_variable(std::string_view name)
+  {
+    throw expression_error {"no variable " + std::string{name}};
+  }
+}
+
+template<typename Source>
+class Static_Expression
+{
+public:
+  static constexpr std::size_t variable_count{static_expression::program<Source>.variable_count};
+
+  using Environment = std::array<long double, variable_count>;
+
+  static constexpr std::string_view infix() { return Source::text(); }
+
+  static constexpr std::size_t variable_slot(std::string_view name)
+  {
+    std::size_t slot{static_expression::program<Source>.slot(name)};
+    if (slot == variable_count)
+      {
+        static_expression::no_variable(name);
+      }
+    return slot;
+  }
+
+  // Alla variabler är 0 från början, som i make_expression.
+  static constexpr Environment make_environment() { return {}; }
+
+  template<typename Values>
+  constexpr long double evaluate(Values&& environment) const
+  {
+    return Root::evaluate(environment);
+  }
+
+  constexpr long double evaluate() const
+  {
+    Environment environment{};
+    return Root::evaluate(environment);
+  }
+
+  // Samma uttryck tolkat vid körningen, t.ex. för utskrift.
+  Expression make_expression() const { return ::make_expression(infix()); }
+
+private:
+  // Tvingar fram tolkningen, och därmed eventuella syntaxfel, när typen
+  // instansieras och inte först vid första evaluate().
+  static_assert(static_expression::program<Source>.node_count > 0);
+
+  using Root = static_expression::Term<Source, static_expression::program<Source>.root>;
+};
+
+/**
+ * STATIC_EXPRESSION: Skapar ett Static_Expression av en strängliteral.
+ * Literalen bärs av en lokal klass eftersom C++17 inte tillåter strängar
+ * som mallargument.
+ */
+#define STATIC_EXPRESSION(infix_literal)                                      \
+  ([] {                                                                       \
+     struct Source                                                            \
+     {                                                                        \
+       static constexpr std::string_view text() { return infix_literal; }     \
+     };                                                                       \
+     return Static_Expression<Source>{};                                      \
+   }())
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Subtree_Table.cc
+ */
+#include "Subtree_Table.h"
+#include <functional>
+#include <typeinfo>
+#include <utility>
+
+using namespace std;
+
+bool Subtree_Table::Key::operator ==(const Key& other) const
+{
+  return kind == other.kind && value == other.value && name == other.name &&
+    left == other.left && right == other.right;
+}
+
+std::size_t Subtree_Table::Key_Hash::operator ()(const Key& key) const
+{
+  std::size_t seed{key.kind.hash_code()};
+  auto combine = [&seed](std::size_t h)
+    {
+      seed ^= h + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+    };
+  combine(hash<long double>{}(key.value));
+  combine(hash<string>{}(key.name));
+  combine(hash<const Expression_Tree*>{}(key.left));
+  combine(hash<const Expression_Tree*>{}(key.right));
+  return seed;
+}
+
+Expression_Tree* Subtree_Table::intern(Expression_Tree* operand)
+{
+  if (dynamic_cast<Variable*>(operand) != nullptr)
+    {
+      return lookup(Key{typeid(*operand), 0, operand->str(), nullptr, nullptr}, operand);
+    }
+  return lookup(Key{typeid(*operand), operand->evaluate(), {}, nullptr, nullptr}, operand);
+}
+
+Expression_Tree* Subtree_Table::intern(Expression_Tree* node,
+                                       const Expression_Tree* left, const Expression_Tree* right)
+{
+  return lookup(Key{typeid(*node), 0, {}, left, right}, node);
+}
+
+void Subtree_Table::clear()
+{
+  nodes.clear();
+}
+
+Expression_Tree* Subtree_Table::lookup(Key key, Expression_Tree* node)
+{
+  auto result = nodes.emplace(std::move(key), node);
+  if (!result.second)
+    {
+      result.first->second->shared = true;
+    }
+  return result.first->second;
+}
@@ -0,0 +1,47 @@
+/*
+ * Subtree_Table.h
+ */
+#ifndef SUBTREE_TABLE_H
+#define SUBTREE_TABLE_H
+#include "Expression_Tree.h"
+#include <cstddef>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+
+/**
+ * Subtree_Table: Tabell för hash-consing av uttrycksträd. En nod söks upp
+ * på sin typ, sitt värde eller namn och sina (redan delade) barn; finns en
+ * strukturellt lika nod returneras den i stället och markeras som delad.
+ */
+class Subtree_Table
+{
+public:
+  Expression_Tree* intern(Expression_Tree* operand);
+  Expression_Tree* intern(Expression_Tree* node,
+                          const Expression_Tree* left, const Expression_Tree* right);
+  void             clear();
+
+private:
+  struct Key
+  {
+    std::type_index        kind;
+    long double            value;
+    std::string            name;
+    const Expression_Tree* left;
+    const Expression_Tree* right;
+
+    bool operator ==(const Key& other) const;
+  };
+
+  struct Key_Hash
+  {
+    std::size_t operator ()(const Key& key) const;
+  };
+
+  Expression_Tree* lookup(Key key, Expression_Tree* node);
+
+  std::unordered_map<Key, Expression_Tree*, Key_Hash> nodes;
+};
+
+#endif
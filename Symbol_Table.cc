@@ -0,0 +1,59 @@
+/*
+ * Symbol_Table.cc
+ */
+#include "Symbol_Table.h"
+#include <utility>
+
+using namespace std;
+
+std::size_t Symbol_Table::intern(std::string_view name, long double initial_value)
+{
+  auto it = slots.find(name);
+  if (it != slots.end())
+    {
+      return it->second;
+    }
+
+  std::size_t slot{names.size()};
+  names.emplace_back(name);
+  values.push_back(initial_value);
+  slots.emplace(names.back(), slot);
+  return slot;
+}
+
+std::size_t Symbol_Table::slot(std::string_view name) const
+{
+  auto it = slots.find(name);
+  if (it == slots.end())
+    {
+      return npos;
+    }
+  return it->second;
+}
+
+const std::string& Symbol_Table::name(std::size_t slot) const
+{
+  return names.at(slot);
+}
+
+std::size_t Symbol_Table::size() const
+{
+  return names.size();
+}
+
+const std::vector<long double>& Symbol_Table::initial_values() const
+{
+  return values;
+}
+
+void Symbol_Table::set_initial_value(std::size_t slot, long double value)
+{
+  values.at(slot) = value;
+}
+
+void Symbol_Table::swap(Symbol_Table& other) noexcept
+{
+  std::swap(names, other.names);
+  std::swap(values, other.values);
+  std::swap(slots, other.slots);
+}
@@ -0,0 +1,38 @@
+/*
+ * Symbol_Table.h
+ */
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Symbol_Table: Knyter varje variabelnamn i ett uttryck till en plats
+ * (slot) i en miljö, en platt array med ett värde per variabel. Alla
+ * förekomster av samma namn delar plats.
+ */
+class Symbol_Table
+{
+public:
+  static constexpr std::size_t npos{static_cast<std::size_t>(-1)};
+
+  std::size_t intern(std::string_view name, long double initial_value = 0);
+  std::size_t slot(std::string_view name) const;
+
+  const std::string&              name(std::size_t slot) const;
+  std::size_t                     size() const;
+  const std::vector<long double>& initial_values() const;
+  void                            set_initial_value(std::size_t slot, long double value);
+  void                            swap(Symbol_Table&) noexcept;
+
+private:
+  std::vector<std::string>                         names;
+  std::vector<long double>                         values;
+  std::map<std::string, std::size_t, std::less<>> slots;
+};
+
+#endif
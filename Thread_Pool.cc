@@ -0,0 +1,149 @@
+/*
+ * Thread_Pool.cc
+ */
+#include "Thread_Pool.h"
+#include <algorithm>
+
+using namespace std;
+
+Thread_Pool::Thread_Pool(unsigned threads)
+{
+  if (threads == 0)
+    {
+      threads = max(thread::hardware_concurrency(), 1u);
+    }
+
+  try
+    {
+      for (unsigned i{1}; i < threads; ++i)
+        {
+          workers.emplace_back([this] { work(); });
+        }
+    }
+  catch (...)
+    {
+      {
+        lock_guard<std::mutex> guard{mutex};
+        stopping = true;
+      }
+      wake.notify_all();
+      for (thread& worker : workers)
+        {
+          worker.join();
+        }
+      throw;
+    }
+}
+
+Thread_Pool::~Thread_Pool()
+{
+  {
+    lock_guard<std::mutex> guard{mutex};
+    stopping = true;
+  }
+  wake.notify_all();
+  for (thread& worker : workers)
+    {
+      worker.join();
+    }
+}
+
+unsigned Thread_Pool::size() const
+{
+  return static_cast<unsigned>(workers.size()) + 1;
+}
+
+void Thread_Pool::run(std::size_t n, const std::function<void(std::size_t)>& f)
+{
+  if (n == 0)
+    {
+      return;
+    }
+
+  Job job;
+  job.task = &f;
+  job.count = n;
+  if (n > 1 && !workers.empty())
+    {
+      {
+        lock_guard<std::mutex> guard{mutex};
+        jobs.push_back(&job);
+      }
+      wake.notify_all();
+    }
+
+  help(job);
+
+  // Jobbet tas bort så att inga fler arbetare börjar på det; de som redan
+  // hjälper till måste bli klara innan job försvinner med stacken.
+  if (n > 1 && !workers.empty())
+    {
+      unique_lock<std::mutex> lock{mutex};
+      jobs.erase(find(jobs.begin(), jobs.end(), &job));
+      done.wait(lock, [&job] { return job.helpers == 0; });
+    }
+  if (job.failure)
+    {
+      rethrow_exception(job.failure);
+    }
+}
+
+void Thread_Pool::help(Job& job)
+{
+  for (std::size_t i{job.next++}; i < job.count && !job.failed; i = job.next++)
+    {
+      try
+        {
+          (*job.task)(i);
+        }
+      catch (...)
+        {
+          lock_guard<std::mutex> guard{mutex};
+          if (!job.failed.exchange(true))
+            {
+              job.failure = current_exception();
+            }
+        }
+    }
+}
+
+Thread_Pool::Job* Thread_Pool::find_job() const
+{
+  for (Job* job : jobs)
+    {
+      if (job->next < job->count && !job->failed)
+        {
+          return job;
+        }
+    }
+  return nullptr;
+}
+
+void Thread_Pool::work()
+{
+  while (true)
+    {
+      Job* job{nullptr};
+      {
+        unique_lock<std::mutex> lock{mutex};
+        wake.wait(lock, [&] { return stopping || (job = find_job()) != nullptr; });
+        if (stopping)
+          {
+            return;
+          }
+        ++job->helpers;
+      }
+
+      help(*job);
+
+      bool last{false};
+      {
+        lock_guard<std::mutex> guard{mutex};
+        last = --job->helpers == 0;
+      }
+      if (last)
+        {
+          done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * Thread_Pool.h
+ */
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Thread_Pool: Trådar som startas en gång och sedan väntar på arbete, så
+ * att ett parallellt steg inte kostar en trådstart.
+ *
+ * run(count, task) anropar task(i) för i = 0 ... count - 1, fördelat över
+ * poolens trådar och den anropande tråden, och återvänder när alla anrop
+ * är klara. Ett undantag från task kastas vidare från run(), efter att de
+ * övriga anropen avslutats; återstående index körs då inte. Flera run()
+ * kan pågå samtidigt, från olika trådar eller inifrån en uppgift: varje
+ * anrop blir ett eget jobb, och lediga trådar tar index från det äldsta
+ * jobb som har index kvar.
+ */
+class Thread_Pool
+{
+public:
+  // threads är antalet trådar inklusive den anropande; 0 betyder en per kärna.
+  explicit Thread_Pool(unsigned threads = 0);
+  ~Thread_Pool();
+
+  unsigned size() const;
+  void     run(std::size_t count, const std::function<void(std::size_t)>& task);
+
+private:
+  // Ett anrop av run(), på den anropande trådens stack.
+  struct Job
+  {
+    const std::function<void(std::size_t)>* task;
+    std::size_t                             count;
+    std::atomic<std::size_t>                next{0};
+    std::size_t                             helpers{0};   // arbetare i help()
+    std::exception_ptr                      failure;
+    std::atomic<bool>                       failed{false};
+  };
+
+  void work();
+  void help(Job& job);
+  Job* find_job() const;
+
+  std::vector<std::thread>                   workers;
+  std::mutex                                 mutex;
+  std::condition_variable                    wake;
+  std::condition_variable                    done;
+  std::vector<Job*>                          jobs;          // i startordning
+  bool                                       stopping{false};
+
+  Thread_Pool(const Thread_Pool&) = delete;
+  Thread_Pool& operator =(const Thread_Pool&) = delete;
+};
+
+#endif
@@ -0,0 +1,447 @@
+/*
+ * expression-bench.cc
+ *
+ * Mätprogram för biblioteket. Genererar slumpmässiga uttryck av given
+ * storlek, djup och operatorblandning och mäter genomströmning och
+ * latens (percentiler) för make_expression, Expression::evaluate (i long
+ * double, double och float, samt på en Thread_Pool med en tråd per kärna),
+ * Expression_Tree::clone, Expression::get_postfix och destruktion.
+ *
+ * Användning:
+ *   expression-bench [--size=N] [--depth=N] [--mix=+:4,-:2,*:3,/:1,^:1]
+ *                    [--expressions=N] [--samples=N] [--seed=N]
+ *                    [--format=text|json|csv]
+ */
+#include "Expression.h"
+#include "Expression_Tree.h"
+#include "Instrumentation.h"
+#include "Thread_Pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace
+{
+   using Clock = chrono::steady_clock;
+
+   struct Settings
+   {
+      int           size{32};         // antal operatorer per uttryck
+      int           depth{12};        // största djup
+      map<char,int> mix{{'+', 4}, {'-', 2}, {'*', 3}, {'/', 1}, {'^', 1}};
+      int           expressions{64};  // antal olika uttryck som mäts
+      int           samples{2000};    // antal mätpunkter per operation
+      unsigned      seed{1};
+      string        format{"text"};
+   };
+
+   const char* const variable_names[]{"a", "b", "c", "x", "y", "z"};
+
+   struct Generated
+   {
+      string           infix;
+      Expression_Tree* tree;
+   };
+
+   /*
+    * Generator: bygger samtidigt infixsträngen och motsvarande träd, så att
+    * clone() och destruktion kan mätas på ett träd utan arena.
+    */
+   class Generator
+   {
+   public:
+      Generator(const Settings& settings)
+         : settings{settings}, random{settings.seed}
+      {
+         for (const auto& entry : settings.mix)
+         {
+            if (entry.second > 0)
+            {
+               operators.push_back(entry.first);
+               weights.push_back(entry.second);
+            }
+         }
+         if (operators.empty())
+            throw invalid_argument{"tom operatorblandning"};
+         choose = discrete_distribution<int>{weights.begin(), weights.end()};
+      }
+
+      Generated make()
+      {
+         int size{min(settings.size, capacity(settings.depth))};
+         return make(size, settings.depth);
+      }
+
+   private:
+      // Största antal operatorer i ett träd med högst depth nivåer.
+      static int capacity(int depth)
+      {
+         return depth <= 1 ? 0 : (depth >= 31 ? 1 << 30 : (1 << (depth - 1)) - 1);
+      }
+
+      Generated make(int size, int depth)
+      {
+         if (size == 0)
+            return leaf(false);
+
+         char op{operators[choose(random)]};
+
+         int most{capacity(depth - 1)};
+
+         // Nämnare och exponenter är alltid löv: inga divisioner med noll och
+         // inga exponenter som spränger talområdet. Får inte resten plats i
+         // vänster delträd blir det en addition i stället.
+         if ((op == '/' || op == '^') && size - 1 > most)
+            op = '+';
+         if (op == '/' || op == '^')
+         {
+            Generated left{make(size - 1, depth - 1)};
+            Generated right{op == '/' ? leaf(true) : exponent()};
+            return combine(op, left, right);
+         }
+
+         int low{max(0, size - 1 - most)};
+         int high{min(size - 1, most)};
+         int left_size{uniform_int_distribution<int>{low, high}(random)};
+         Generated left{make(left_size, depth - 1)};
+         Generated right{make(size - 1 - left_size, depth - 1)};
+         return combine(op, left, right);
+      }
+
+      Generated leaf(bool nonzero)
+      {
+         switch (uniform_int_distribution<int>{0, 2}(random))
+         {
+         case 0:
+         {
+            long long value{uniform_int_distribution<long long>{nonzero ? 1 : 0, 9}(random)};
+            return {to_string(value), new Integer{value}};
+         }
+         case 1:
+         {
+            int tenths{uniform_int_distribution<int>{1, 99}(random)};
+            string text{to_string(tenths / 10) + '.' + to_string(tenths % 10)};
+            return {text, new Real{tenths / 10.0L}};
+         }
+         default:
+         {
+            const char* name{variable_names[uniform_int_distribution<int>{0, 5}(random)]};
+            return {name, new Variable{name, 1.5}};
+         }
+         }
+      }
+
+      Generated exponent()
+      {
+         long long value{uniform_int_distribution<long long>{1, 3}(random)};
+         return {to_string(value), new Integer{value}};
+      }
+
+      static Generated combine(char op, Generated& left, Generated& right)
+      {
+         string infix{'(' + left.infix + ' ' + op + ' ' + right.infix + ')'};
+         Expression_Tree* tree{};
+         switch (op)
+         {
+         case '+': tree = new Plus{left.tree, right.tree}; break;
+         case '-': tree = new Minus{left.tree, right.tree}; break;
+         case '*': tree = new Times{left.tree, right.tree}; break;
+         case '/': tree = new Divide{left.tree, right.tree}; break;
+         default:  tree = new Power{left.tree, right.tree}; break;
+         }
+         return {infix, tree};
+      }
+
+      const Settings&             settings;
+      mt19937                     random;
+      vector<char>                operators;
+      vector<int>                 weights;
+      discrete_distribution<int>  choose;
+   };
+
+   struct Result
+   {
+      string name;
+      long   calls{0};
+      double seconds{0};
+      double p50{0}, p90{0}, p99{0}, max{0};   // nanosekunder per anrop
+   };
+
+   /*
+    * measure: Kör operation(i) i mätpunkter om batch anrop. Batchstorleken
+    * väljs så att en mätpunkt tar minst några mikrosekunder, så att klockans
+    * egen kostnad inte dominerar korta operationer. Latensen är tiden per
+    * anrop inom en mätpunkt. prepare(batch) körs före varje mätpunkt och
+    * finish(batch) efter den, utan att räknas.
+    */
+   template<typename Prepare, typename Operation, typename Finish>
+   Result measure(const string& name, int samples,
+                  Prepare prepare, Operation operation, Finish finish)
+   {
+      const auto target = chrono::microseconds{5};
+      int batch{1};
+      for (;;)
+      {
+         prepare(batch);
+         auto start = Clock::now();
+         for (int i{0}; i < batch; ++i)
+            operation(i);
+         auto elapsed = Clock::now() - start;
+         finish(batch);
+         if (elapsed >= target)
+            break;
+         batch *= 2;
+      }
+
+      Result result{name};
+      vector<double> latencies;
+      latencies.reserve(samples);
+      for (int s{0}; s < samples; ++s)
+      {
+         prepare(batch);
+         auto start = Clock::now();
+         for (int i{0}; i < batch; ++i)
+            operation(i);
+         auto elapsed = chrono::duration<double>(Clock::now() - start).count();
+         finish(batch);
+
+         result.calls += batch;
+         result.seconds += elapsed;
+         latencies.push_back(elapsed * 1e9 / batch);
+      }
+
+      sort(latencies.begin(), latencies.end());
+      auto percentile = [&latencies](double p)
+      {
+         return latencies[min(latencies.size() - 1,
+                              static_cast<size_t>(p * latencies.size()))];
+      };
+      result.p50 = percentile(0.50);
+      result.p90 = percentile(0.90);
+      result.p99 = percentile(0.99);
+      result.max = latencies.back();
+      return result;
+   }
+
+   Settings parse_arguments(int argc, char* argv[])
+   {
+      Settings settings;
+      for (int i{1}; i < argc; ++i)
+      {
+         string argument{argv[i]};
+         auto equals = argument.find('=');
+         string key{argument.substr(0, equals)};
+         string value{equals == string::npos ? "" : argument.substr(equals + 1)};
+
+         if (key == "--size")
+            settings.size = stoi(value);
+         else if (key == "--depth")
+            settings.depth = stoi(value);
+         else if (key == "--expressions")
+            settings.expressions = stoi(value);
+         else if (key == "--samples")
+            settings.samples = stoi(value);
+         else if (key == "--seed")
+            settings.seed = static_cast<unsigned>(stoul(value));
+         else if (key == "--format")
+            settings.format = value;
+         else if (key == "--mix")
+         {
+            // Formatet är op:vikt,op:vikt,...
+            settings.mix.clear();
+            size_t start{0};
+            while (start < value.size())
+            {
+               size_t end{value.find(',', start)};
+               if (end == string::npos)
+                  end = value.size();
+               string item{value.substr(start, end - start)};
+               if (item.size() < 3 || item[1] != ':' ||
+                   string{"+-*/^"}.find(item[0]) == string::npos)
+                  throw invalid_argument{"felaktig operatorblandning: " + item};
+               settings.mix[item[0]] = stoi(item.substr(2));
+               start = end + 1;
+            }
+         }
+         else
+            throw invalid_argument{"okänt argument: " + argument};
+      }
+
+      if (settings.size < 0 || settings.depth < 1 || settings.expressions < 1 ||
+          settings.samples < 1)
+         throw invalid_argument{"storlek, djup och antal måste vara positiva"};
+      if (settings.format != "text" && settings.format != "json" && settings.format != "csv")
+         throw invalid_argument{"okänt format: " + settings.format};
+      return settings;
+   }
+
+   void print_results(const Settings& settings, const vector<Result>& results)
+   {
+      if (settings.format == "json")
+      {
+         cout << "{\n  \"settings\": {\"size\": " << settings.size
+              << ", \"depth\": " << settings.depth
+              << ", \"expressions\": " << settings.expressions
+              << ", \"samples\": " << settings.samples
+              << ", \"seed\": " << settings.seed << ", \"mix\": \"";
+         for (auto it = settings.mix.begin(); it != settings.mix.end(); ++it)
+            cout << (it == settings.mix.begin() ? "" : ",") << it->first << ':' << it->second;
+         cout << "\"},\n  \"results\": [\n";
+         for (size_t i{0}; i < results.size(); ++i)
+         {
+            const Result& r{results[i]};
+            cout << "    {\"name\": \"" << r.name << "\", \"calls\": " << r.calls
+                 << ", \"ops_per_second\": " << r.calls / r.seconds
+                 << ", \"p50_ns\": " << r.p50 << ", \"p90_ns\": " << r.p90
+                 << ", \"p99_ns\": " << r.p99 << ", \"max_ns\": " << r.max << '}'
+                 << (i + 1 < results.size() ? ",\n" : "\n");
+         }
+         cout << "  ]\n}\n";
+      }
+      else if (settings.format == "csv")
+      {
+         cout << "name,size,depth,calls,ops_per_second,p50_ns,p90_ns,p99_ns,max_ns\n";
+         for (const Result& r : results)
+            cout << r.name << ',' << settings.size << ',' << settings.depth << ','
+                 << r.calls << ',' << r.calls / r.seconds << ',' << r.p50 << ','
+                 << r.p90 << ',' << r.p99 << ',' << r.max << '\n';
+      }
+      else
+      {
+         cout << "storlek " << settings.size << ", djup " << settings.depth
+              << ", " << settings.expressions << " uttryck, "
+              << settings.samples << " mätpunkter\n\n"
+              << left << setw(18) << "operation" << right
+              << setw(14) << "anrop/s" << setw(12) << "p50 ns" << setw(12) << "p90 ns"
+              << setw(12) << "p99 ns" << setw(12) << "max ns" << '\n';
+         cout << fixed << setprecision(1);
+         for (const Result& r : results)
+            cout << left << setw(18) << r.name << right
+                 << setw(14) << r.calls / r.seconds << setw(12) << r.p50
+                 << setw(12) << r.p90 << setw(12) << r.p99 << setw(12) << r.max << '\n';
+      }
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   Settings settings;
+   try
+   {
+      settings = parse_arguments(argc, argv);
+   }
+   catch (const exception& e)
+   {
+      cerr << e.what() << '\n';
+      return 2;
+   }
+
+   Generator generator{settings};
+   vector<string>           infix;
+   vector<Expression_Tree*> trees;
+   for (int i{0}; i < settings.expressions; ++i)
+   {
+      Generated generated{generator.make()};
+      infix.push_back(generated.infix);
+      trees.push_back(generated.tree);
+   }
+
+   const int count{settings.expressions};
+   vector<Result> results;
+   auto nothing = [](int) {};
+
+   // Resultatet av varje operation samlas i sink så att den inte optimeras bort.
+   volatile long double sink{0};
+
+   results.push_back(measure("make_expression", settings.samples, nothing,
+      [&](int i) { sink = make_expression(infix[i % count]).empty(); }, nothing));
+
+   // Variablerna får samma nollskilda värde som i de genererade träden.
+   vector<Expression> expressions;
+   for (const string& text : infix)
+   {
+      expressions.push_back(make_expression(text));
+      for (const char* name : variable_names)
+         if (text.find(name) != string::npos)
+            expressions.back().set_variable(name, 1.5);
+   }
+
+   results.push_back(measure("evaluate", settings.samples, nothing,
+      [&](int i) { sink = expressions[i % count].evaluate(); }, nothing));
+
+   // Samma uttryck i double och float, med miljöer av motsvarande typ.
+   vector<vector<double>> double_environments;
+   vector<vector<float>>  float_environments;
+   for (const Expression& expression : expressions)
+   {
+      double_environments.push_back(expression.make_environment<double>());
+      float_environments.push_back(expression.make_environment<float>());
+   }
+
+   results.push_back(measure("evaluate_double", settings.samples, nothing,
+      [&](int i) { sink = expressions[i % count].evaluate(double_environments[i % count].data()); },
+      nothing));
+
+   results.push_back(measure("evaluate_float", settings.samples, nothing,
+      [&](int i) { sink = expressions[i % count].evaluate(float_environments[i % count].data()); },
+      nothing));
+
+   // Bara uttryck med tiotusentals operatorer (t.ex. --size=100000
+   // --depth=24) delas på trådarna; mindre räknas på den anropande tråden.
+   Thread_Pool pool;
+   results.push_back(measure("evaluate_parallel", settings.samples, nothing,
+      [&](int i) { sink = expressions[i % count].evaluate(pool); }, nothing));
+
+   results.push_back(measure("get_postfix", settings.samples, nothing,
+      [&](int i) { sink = expressions[i % count].get_postfix().size(); }, nothing));
+
+   // clone och destruktion av träd utan arena: klonerna tas bort utanför
+   // mätningen av clone och skapas utanför mätningen av destruktionen.
+   vector<Expression_Tree*> clones;
+   auto clear_clones = [&clones](int)
+   {
+      for (Expression_Tree* clone : clones)
+         delete clone;
+      clones.clear();
+   };
+   results.push_back(measure("clone", settings.samples, nothing,
+      [&](int i) { clones.push_back(trees[i % count]->clone()); }, clear_clones));
+
+   auto make_clones = [&](int batch)
+   {
+      for (int i{0}; i < batch; ++i)
+         clones.push_back(trees[i % count]->clone());
+   };
+   results.push_back(measure("delete_tree", settings.samples, make_clones,
+      [&](int i) { delete clones[i]; clones[i] = nullptr; },
+      [&clones](int) { clones.clear(); }));
+
+   // Destruktion av Expression (träd i arena plus program).
+   vector<Expression> doomed;
+   auto make_doomed = [&](int batch)
+   {
+      for (int i{0}; i < batch; ++i)
+         doomed.push_back(make_expression(infix[i % count]));
+   };
+   results.push_back(measure("destroy", settings.samples, make_doomed,
+      [&](int i) { Expression{}.swap(doomed[i]); },
+      [&doomed](int) { doomed.clear(); }));
+
+   for (Expression_Tree* tree : trees)
+      delete tree;
+
+   print_results(settings, results);
+   // Med make INSTRUMENTATION=1 även bibliotekets egna räknare, på cerr.
+   if (instrumentation::enabled)
+      instrumentation::write(cerr, instrumentation::snapshot());
+   return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * expression-bulk.cc
+ *
+ * Tolkar och utvärderar en fil med ett infixuttryck per rad, parallellt
+ * över alla kärnor. Resultaten skrivs i indatans ordning, en rad per
+ * uttryck, med "error: ..." för rader som inte kunde utvärderas.
+ *
+ * Användning:
+ *   expression-bulk [--threads=N] [--precision=N] [--simplify] [--share]
+ *                   [--type=float|double|long-double]
+ *                   [--set=namn:värde ...] [--summary] fil
+ */
+#include "Bulk_Evaluation.h"
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+using namespace std;
+
+namespace
+{
+   struct Settings
+   {
+      Bulk_Options options;
+      int          precision{6};
+      bool         summary{false};   // bara antal rader, fel och tid på cerr
+      string       path;
+   };
+
+   Settings parse_arguments(int argc, char* argv[])
+   {
+      Settings settings;
+      for (int i{1}; i < argc; ++i)
+      {
+         string argument{argv[i]};
+         auto equals = argument.find('=');
+         string key{argument.substr(0, equals)};
+         string value{equals == string::npos ? "" : argument.substr(equals + 1)};
+
+         if (key == "--threads")
+            settings.options.threads = static_cast<unsigned>(stoul(value));
+         else if (key == "--precision")
+            settings.precision = stoi(value);
+         else if (key == "--simplify")
+            settings.options.options.simplify = true;
+         else if (key == "--share")
+            settings.options.options.share_subexpressions = true;
+         else if (key == "--type")
+         {
+            if (value == "float")
+               settings.options.options.number_type = Number_Type::float_type;
+            else if (value == "double")
+               settings.options.options.number_type = Number_Type::double_type;
+            else if (value == "long-double")
+               settings.options.options.number_type = Number_Type::long_double_type;
+            else
+               throw invalid_argument{"okänd taltyp: " + value};
+         }
+         else if (key == "--set")
+         {
+            auto colon = value.find(':');
+            if (colon == string::npos || colon == 0)
+               throw invalid_argument{"felaktig variabel: " + value};
+            settings.options.variables.emplace_back(value.substr(0, colon),
+                                                    stold(value.substr(colon + 1)));
+         }
+         else if (key == "--summary")
+            settings.summary = true;
+         else if (argument.size() > 1 && argument[0] == '-')
+            throw invalid_argument{"okänt argument: " + argument};
+         else if (settings.path.empty())
+            settings.path = argument;
+         else
+            throw invalid_argument{"bara en fil kan anges"};
+      }
+
+      if (settings.path.empty())
+         throw invalid_argument{"ingen fil angiven"};
+      return settings;
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   Settings settings;
+   try
+   {
+      settings = parse_arguments(argc, argv);
+   }
+   catch (const exception& e)
+   {
+      cerr << e.what() << '\n';
+      return 2;
+   }
+
+   try
+   {
+      auto        start = chrono::steady_clock::now();
+      Bulk_Result result{evaluate_file(settings.path, settings.options)};
+      chrono::duration<double> elapsed{chrono::steady_clock::now() - start};
+
+      if (settings.summary)
+         cerr << result.size() << " rader, " << result.errors().size() << " fel, "
+              << elapsed.count() << " s\n";
+      else
+         result.write(cout, settings.precision);
+      return result.errors().empty() ? 0 : 1;
+   }
+   catch (const exception& e)
+   {
+      cerr << e.what() << '\n';
+      return 2;
+   }
+}
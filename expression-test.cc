@@ -1,10 +1,27 @@
 /*
  * expression-test.cc
  */
+#include "Bulk_Evaluation.h"
 #include "Expression.h"
+#include "Expression_Cache.h"
+#include "Expression_Image.h"
+#include "Expression_Program.h"
 #include "Expression_Tree.h"
+#include "Instrumentation.h"
+#include "Static_Expression.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <random>
+#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 using namespace std;
 
 int main()
@@ -25,7 +42,7 @@ int main()
    }
    catch (const exception& e)
    {
-      cout << "undantag fngat: " << e.what() << '\n';
+      cout << "undantag fångat: " << e.what() << '\n';
    }
 
    cout << "e2.get_postfix() = " << e2.get_postfix() << '\n';
@@ -33,11 +50,11 @@ int main()
    
    e2.swap(e1);  // swap
 
-   // Resten krver implementering av Expression_Tree-klasserna.
+   // Resten kräver implementering av Expression_Tree-klasserna.
 
    Expression_Tree* t{new Plus{new Integer{7}, new Real{3.14}}};
 
-   Expression e3{t};  // konstruktor som tar ett lnkat uttryckstrd
+   Expression e3{t};  // konstruktor som tar ett länkat uttrycksträd
 
    cout << "e3.evaluate() = " << e3.evaluate() << '\n';
    cout << "e3.get_postfix() = " << e3.get_postfix() << '\n';
@@ -57,7 +74,7 @@ int main()
    }
    catch (const exception& e)
    {
-      cout << "Undantag fngat: " << e.what() << '\n';
+      cout << "Undantag fångat: " << e.what() << '\n';
    }
    cout << "e4.get_postfix() = " << e4.get_postfix() << '\n';
    cout << "e4.empty() = " << e4.empty() << "\n\n";
@@ -76,7 +93,501 @@ int main()
    cout << "e2.empty() = " << e2.empty() << '\n';
    cout << "e5.empty() = " << e5.empty() << "\n\n";
 
+   Expression e6{make_expression("x * 2 + y ^ 2")};
+   double x[]{1, 2, 3, 4};
+   double y[]{0.5, 1, 1.5, 2};
+   double result[4];
 
+   e6.evaluate_batch({{"x", x}, {"y", y}}, result, 4);  // satsvis utvärdering
+
+   cout << "e6.evaluate_batch() =";
+   for (double r : result)
+      cout << ' ' << r;
+   cout << "\n\n";
+
+   Expression e7{make_expression("x = y * 2 + x")};
+   auto env = e7.make_environment();  // en plats per variabel
+
+   env[e7.variable_slot("x")] = 1;
+   env[e7.variable_slot("y")] = 5;
+   cout << "e7.evaluate(env) = " << e7.evaluate(env.data()) << '\n';
+   cout << "x = " << env[e7.variable_slot("x")] << "\n\n";
+
+   Expression e8{make_expression("(2 + 3) * x ^ 2 * 1 + 0", {true})};  // förenklat
+   cout << "e8.get_postfix() = " << e8.get_postfix() << "\n\n";
+
+   Expression_Options sharing;
+   sharing.share_subexpressions = true;
+   Expression e9{make_expression("(a + b) * (a + b)", sharing)};  // (a+b) beräknas en gång
+   e9.set_variable("a", 1);
+   e9.set_variable("b", 2);
+   cout << "e9.evaluate() = " << e9.evaluate() << '\n';
+   cout << "e9.get_postfix() = " << e9.get_postfix() << '\n';
+
+   // Kopian som set_variable gör av ett delat uttryck delar trädet med
+   // originalet och kopierar bara programmet. Originalets arena, som också
+   // rymmer det odelade trädet med 2^14 löv, räknas då med i kopians storlek;
+   // en klon av de fyrtiotal olika delträden vore mycket mindre.
+   string e9_doubling{"x"};
+   for (int i{0}; i < 14; ++i)
+      e9_doubling = "(" + e9_doubling + " + 1) * (" + e9_doubling + " - 1)";
+   Expression          e9_shared{make_expression(e9_doubling, sharing)};
+   Expression          e9_copy{e9_shared};
+   Expression          e9_unshared{make_expression(e9_doubling)};
+   vector<long double> e9_environment{e9_unshared.make_environment()};
+   e9_copy.set_variable("x", 0.5);
+   e9_environment[e9_unshared.variable_slot("x")] = 0.5;
+   cout << "delat träd: " << boolalpha
+        << (e9_copy.memory_size() * 2 > e9_shared.memory_size())
+        << ", samma värde: "
+        << (e9_copy.evaluate() == e9_unshared.evaluate(e9_environment.data()))
+        << noboolalpha << "\n\n";
+
+   // Inkrementell utvärdering: bara delträd som beror på ändrad variabel räknas om.
+   Incremental_Evaluation e10{make_expression("a * b + c / (d + 1)").make_incremental()};
+   e10.set("a", 2);
+   e10.set("b", 3);
+   e10.set("c", 8);
+   e10.set("d", 3);
+   cout << "e10.evaluate() = " << e10.evaluate() << '\n';
+   e10.set("c", 4);
+   cout << "e10.evaluate() = " << e10.evaluate() << "\n\n";
+
+   // Mycket djupa träd: inga genomgångar är rekursiva.
+   string long_sum{"a"};
+   for (int i{0}; i < 200000; ++i)
+      long_sum += "+a";
+   Expression e11{make_expression(long_sum)};
+   e11.set_variable("a", 0.5);
+   cout << "e11.evaluate() = " << e11.evaluate() << '\n';
+   cout << "e11.get_postfix().size() = " << e11.get_postfix().size() << "\n\n";
+
+   // Utskrift direkt till en ström eller till en återanvänd buffert.
+   Expression e12{make_expression("x = (a - (b - c)) * 2 ^ 3 ^ 2")};
+   cout << "e12.write_infix() = ";
+   e12.write_infix(cout);
+   cout << '\n';
+   string buffer;
+   e12.write_postfix(buffer);
+   cout << "e12.write_postfix() = " << buffer << '\n';
+   buffer.clear();
+   e12.print_tree(buffer);
+   cout << buffer << '\n';
+
+   // Maskinkod; potensen med decimalexponent utvärderas av tolken.
+   Expression      e13{make_expression("(a * b + c / (a + 1)) ^ 2 - x * 3")};
+   Native_Function f13{e13.make_native()};
+   double          v13[4]{1.0, 2.0, 3.0, 4.0};
+   cout << "f13.native() = " << f13.native() << '\n';
+   cout << "f13(1, 2, 3, 4) = " << f13(v13) << '\n';
+   double a13[]{1.0, 2.0, 3.0};
+   double b13[]{2.0, 2.0, 2.0};
+   double c13[]{3.0, 3.0, -3.0};
+   double x13[]{4.0, 0.0, 1.0};
+   double r13[3];
+   f13.run_batch({{"a", a13}, {"b", b13}, {"c", c13}, {"x", x13}}, r13, 3);
+   cout << "f13.run_batch() = " << r13[0] << ' ' << r13[1] << ' ' << r13[2] << '\n';
+   Native_Function g13{make_expression("a ^ 1.5").make_native()};
+   cout << "g13.native() = " << g13.native() << ", g13(4) = " << g13(v13 + 3) << '\n';
+   try
+   {
+      make_expression("a / (b - 2)").make_native()(v13);
+   }
+   catch (const exception& e)
+   {
+      cout << "f13: " << e.what() << '\n';
+   }
+
+   // Slumpade uttryck jämförs med evaluate(double*), både för uttryck som
+   // översätts till maskinkod och för dem som tolken tar hand om: heltals-
+   // och decimalexponenter, variabel exponent, division med noll och
+   // tilldelning. Potenser med heltalsexponent räknas med multiplikationer
+   // i maskinkoden och kan skilja sig i sista biten från pow.
+   mt19937 random13{13};
+   const char* const names13[]{"a", "b", "c", "x"};
+   const double      values13[]{-1.5, 0.0, 0.5, 2.0, 3.0};
+   function<string(int)> make13 = [&](int depth) -> string
+   {
+      if (depth == 0 || random13() % 4 == 0)
+      {
+         switch (random13() % 3)
+         {
+         case 0:  return to_string(random13() % 9 + 1);
+         case 1:  return to_string(random13() % 9 + 1) + ".25";
+         default: return names13[random13() % 4];
+         }
+      }
+      switch (random13() % 6)
+      {
+      case 0:  return "(" + make13(depth - 1) + " + " + make13(depth - 1) + ")";
+      case 1:  return "(" + make13(depth - 1) + " - " + make13(depth - 1) + ")";
+      case 2:  return "(" + make13(depth - 1) + " * " + make13(depth - 1) + ")";
+      case 3:  return "(" + make13(depth - 1) + " / (" + names13[random13() % 4] + " - 2))";
+      case 4:
+      {
+         const char* const exponents[]{"2", "3", "0", "5", "1.5", "0.5", "b"};
+         return "(" + make13(depth - 1) + ") ^ " + exponents[random13() % 7];
+      }
+      default: return "(" + make13(depth - 1) + " / " + make13(depth - 1) + ")";
+      }
+   };
+   auto agree13 = [](double expected, double actual)
+   {
+      return (isnan(expected) && isnan(actual)) || expected == actual ||
+         fabs(expected - actual) <= 1e-12 * max(fabs(expected), fabs(actual));
+   };
+
+   const std::size_t rows13{5};
+   int native13{0};
+   int interpreted13{0};
+   int values_checked13{0};
+   int errors13{0};
+   for (int n{0}; n < 300; ++n)
+   {
+      string infix{(random13() % 4 == 0 ? "r = " : "") + make13(4)};
+      Expression      expression{make_expression(infix)};
+      Native_Function native{expression.make_native()};
+      ++(native.native() ? native13 : interpreted13);
+
+      // En kolumn per variabel, och raderna en och en genom evaluate.
+      vector<vector<double>> columns(expression.variable_count(), vector<double>(rows13));
+      Column_Map             column_map;
+      for (const char* name : {"a", "b", "c", "x", "r"})
+      {
+         std::size_t slot{expression.find_variable(name)};
+         if (slot == Symbol_Table::npos)
+            continue;
+         for (double& value : columns[slot])
+            value = values13[random13() % 5];
+         column_map[name] = columns[slot].data();
+      }
+
+      vector<double> expected(rows13);
+      bool           failed{false};
+      for (std::size_t row{0}; row < rows13; ++row)
+      {
+         vector<double> environment(expression.variable_count());
+         for (std::size_t slot{0}; slot < environment.size(); ++slot)
+            environment[slot] = columns[slot][row];
+         const vector<double> variables{environment};
+
+         bool expected_error{false};
+         try
+         {
+            expected[row] = expression.evaluate(environment.data());
+         }
+         catch (const expression_tree_error&)
+         {
+            expected_error = failed = true;
+         }
+         try
+         {
+            double actual{native(variables.data())};
+            if (expected_error || !agree13(expected[row], actual))
+               ++errors13;
+         }
+         catch (const expression_tree_error&)
+         {
+            if (!expected_error)
+               ++errors13;
+         }
+         ++values_checked13;
+      }
+
+      vector<double> result(rows13);
+      try
+      {
+         native.run_batch(column_map, result.data(), rows13);
+         for (std::size_t row{0}; row < rows13; ++row)
+            if (failed || !agree13(expected[row], result[row]))
+               ++errors13;
+      }
+      catch (const expression_tree_error&)
+      {
+         if (!failed)
+            ++errors13;
+      }
+   }
+   cout << "maskinkod mot evaluate: " << native13 << " översatta och " << interpreted13
+        << " tolkade uttryck, " << values_checked13 << " värden"
+        << (errors13 == 0 ? " (stämmer)" : " (FEL)") << "\n\n";
+
+   // Uttryck som tolkas och räknas ut redan vid kompileringen.
+   constexpr auto e14{STATIC_EXPRESSION("x = (a - (b - c)) * 2 ^ 3 ^ 2")};
+   constexpr auto v14{[e14]
+   {
+      auto environment{e14.make_environment()};
+      environment[e14.variable_slot("a")] = 1;
+      environment[e14.variable_slot("b")] = 2;
+      environment[e14.variable_slot("c")] = 3;
+      return e14.evaluate(environment);
+   }()};
+   static_assert(v14 == 1024);
+   static_assert(STATIC_EXPRESSION("(1 + 2) * 3 ^ 2 - 10 / 4").evaluate() == 24.5);
+   long double environment14[]{1, 2, 3, 0};
+   cout << "e14.evaluate() = " << e14.evaluate(environment14)
+        << ", x = " << environment14[e14.variable_slot("x")] << '\n';
+   cout << "e14.make_expression() = " << e14.make_expression().get_postfix() << "\n\n";
+
+   // Binär avbild: uttrycken utvärderas direkt ur avbilden, och en trasig
+   // avbild avvisas när den öppnas.
+   Expression_Image_Writer writer;
+   writer.add(make_expression("x = a * b + c"));
+   writer.add(make_expression("(x + b) / 2", {false, true}));
+   ostringstream image_stream;
+   writer.write(image_stream);
+   const string        image_bytes{image_stream.str()};
+   vector<long double> storage(image_bytes.size() / sizeof(long double) + 1);
+   memcpy(storage.data(), image_bytes.data(), image_bytes.size());
+
+   Expression_Image    image{storage.data(), image_bytes.size()};
+   vector<long double> environment15{image.make_environment()};
+   environment15[image.variable_slot("a")] = 2;
+   environment15[image.variable_slot("b")] = 3;
+   environment15[image.variable_slot("c")] = 4;
+   cout << "image.size() = " << image.size() << ", variables:";
+   for (std::size_t slot{0}; slot < image.variable_count(); ++slot)
+      cout << ' ' << image.variable_name(slot);
+   cout << '\n';
+   cout << "image.evaluate(0) = " << image.evaluate(0, environment15.data()) << '\n';
+   cout << "image.evaluate(1) = " << image.evaluate(1, environment15.data()) << '\n';
+   try
+   {
+      reinterpret_cast<char*>(storage.data())[image_bytes.size() - 1] ^= 0x40;
+      Expression_Image corrupt{storage.data(), image_bytes.size()};
+   }
+   catch (const expression_error& e)
+   {
+      cout << "image: " << e.what() << "\n\n";
+   }
+
+   // Cache för tolkade uttryck; blanktecken påverkar inte nyckeln.
+   Expression_Cache cache{1 << 20};
+   Expression       e16{cache.get("a + b * 2")};
+   cache.get("a+b*2");
+   cache.get("  a +  b*2 ");
+   e16.set_variable("b", 4);
+   cout << "e16.evaluate() = " << e16.evaluate()
+        << ", cache.get().evaluate() = " << cache.get("a+b*2").evaluate() << '\n';
+   cache.set_memory_limit(0);
+   Expression_Cache::Statistics statistics{cache.statistics()};
+   cout << "cache: " << statistics.hits << " träffar, " << statistics.misses << " missar, "
+        << statistics.evictions << " utkastade, " << statistics.entries << " kvar\n\n";
+
+   // Många uttryck, ett per rad, utvärderade parallellt; fel sparas per rad.
+   Bulk_Options bulk_options;
+   bulk_options.threads = 4;
+   bulk_options.variables = {{"a", 2}, {"b", 0.5}};
+   Bulk_Result bulk{evaluate_lines("a * b + 1\n(a\nx = a ^ 3\n\n1 / (b - 0.5)\n2.5", bulk_options)};
+   cout << "evaluate_lines: " << bulk.size() << " rader, " << bulk.errors().size() << " fel\n";
+   bulk.write(cout);
+   bulk_options.options.number_type = Number_Type::float_type;
+   Bulk_Result bulk_float{evaluate_lines("1 / 3 + 0.1", bulk_options)};
+   cout << "evaluate_lines i float: " << boolalpha
+        << (bulk_float.value(0) == 1.0f / 3.0f + 0.1f) << noboolalpha << "\n\n";
+
+   // Samma uttryck i tre precisioner: per anrop med en miljö av annan typ,
+   // eller för hela uttrycket med Expression_Options::number_type.
+   Expression         e17{make_expression("x = 1 / 3 + y")};
+   vector<double>     environment17d{e17.make_environment<double>()};
+   vector<float>      environment17f{e17.make_environment<float>()};
+   environment17d[e17.variable_slot("y")] = 1;
+   environment17f[e17.variable_slot("y")] = 1;
+   cout << setprecision(17)
+        << "e17.evaluate(double) = " << e17.evaluate(environment17d.data())
+        << ", x = " << environment17d[e17.variable_slot("x")] << '\n'
+        << "e17.evaluate(float) = " << e17.evaluate(environment17f.data()) << '\n';
+   Expression e17d{make_expression("1 / 3", Expression_Options{false, false, Number_Type::double_type})};
+   cout << "e17d.evaluate() = " << e17d.evaluate()
+        << (e17d.number_type() == Number_Type::double_type ? " (double)" : "") << "\n\n"
+        << setprecision(6);
+
+   // Alla partiella derivator i ett framåt- och ett bakåtsvep, jämförda med
+   // centrala differenser.
+   Expression          e18{make_expression("y = a * b ^ 2 - a / c + (y + 1) * b")};
+   vector<long double> environment18{e18.make_environment()};
+   vector<long double> gradient18(environment18.size());
+   environment18[e18.variable_slot("a")] = 1.5;
+   environment18[e18.variable_slot("b")] = 2;
+   environment18[e18.variable_slot("c")] = 0.5;
+   vector<long double> point18{environment18};
+   cout << "e18.evaluate_gradient() = "
+        << e18.evaluate_gradient(environment18.data(), gradient18.data()) << '\n';
+   for (const char* name : {"a", "b", "c", "y"})
+   {
+      const std::size_t   slot{e18.variable_slot(name)};
+      const long double   h{1e-6L};
+      vector<long double> above{point18};
+      vector<long double> below{point18};
+      above[slot] += h;
+      below[slot] -= h;
+      long double numeric{(e18.evaluate(above.data()) - e18.evaluate(below.data())) / (2 * h)};
+      cout << "d/d" << name << " = " << gradient18[slot]
+           << (fabsl(numeric - gradient18[slot]) < 1e-6L ? " (stämmer)" : " (FEL)") << '\n';
+   }
+   // Med basen 0 och exponenten 0 är derivatorna 0, inte NaN.
+   for (const char* infix : {"a ^ 0", "a ^ b"})
+   {
+      Expression          zero{make_expression(infix)};
+      vector<long double> environment{zero.make_environment()};
+      vector<long double> gradient(environment.size());
+      long double         value{zero.evaluate_gradient(environment.data(), gradient.data())};
+      bool                zeros{all_of(gradient.begin(), gradient.end(),
+                                        [](long double g) { return g == 0; })};
+      cout << infix << " i 0: " << value << ", derivator " << (zeros ? "0" : "FEL") << '\n';
+   }
+   cout << '\n';
+
+   // Tolkning och utvärdering utan undantag: fel ges som felkod och position.
+   for (const char* infix : {"a * (b + 2", "1 + # 2", "2 = a", "x = a / (b - b)"})
+   {
+      Expression        e19;
+      long double       value{};
+      Expression_Status status{try_make_expression(infix, e19)};
+      if (status)
+         status = e19.try_evaluate(value);
+      cout << "try \"" << infix << "\": ";
+      if (status)
+      {
+         cout << value << '\n';
+         continue;
+      }
+      string message{status.message()};
+      if (message.back() != '\n')
+         message += '\n';
+      cout << "fel " << static_cast<int>(status.code) << " vid " << status.position
+           << ": " << message;
+   }
+   cout << '\n';
+
+   // Tal i alla former som tolken godtar, och några den inte godtar.
+   cout << "tal: " << make_expression("x = .5 + 2. * 007 - 1.25").evaluate() << '\n';
+   for (const char* infix : {"1.2.3", "a1", "99999999999999999999"})
+   {
+      Expression e21;
+      cout << "tal \"" << infix << "\": " << try_make_expression(infix, e21).message();
+   }
+   cout << '\n';
+
+   // Instrumentering, bara med make INSTRUMENTATION=1: räknare för ett
+   // uttryck som skapas, kopieras vid ändring och utvärderas två gånger.
+   instrumentation::reset();
+   Expression e20{make_expression("x = a * (b + 2) - a", Expression_Options{true, true})};
+   Expression e20_copy{e20};
+   e20_copy.set_variable("a", 3);
+   e20.evaluate();
+   e20_copy.evaluate();
+   if (instrumentation::enabled)
+   {
+      instrumentation::Snapshot snapshot{instrumentation::snapshot()};
+      cout << "instrumentering: " << snapshot.expressions << " uttryck, "
+           << snapshot.nodes << " noder, djup " << snapshot.max_depth << ", "
+           << snapshot.evaluations << " utvärderingar, "
+           << snapshot.operations[static_cast<std::size_t>(Opcode::multiply)]
+           << " multiplikationer, " << snapshot.clones << " kloningar, "
+           << (snapshot.allocations > 0 ? "allokeringar räknade" : "inga allokeringar")
+           << "\n\n";
+   }
+   else
+   {
+      cout << "instrumentering: avstängd\n\n";
+   }
+
+   // Program med flera satser som delar variabler. Satserna t och w beror
+   // inte på varandra och hamnar på samma nivå.
+   Expression_Program e22{make_program("t = a * b; w = c - 1\nu = t + c; v = t ^ 2 + u")};
+   vector<long double> e22_environment{e22.make_environment()};
+   e22_environment[e22.variable_slot("a")] = 2;
+   e22_environment[e22.variable_slot("b")] = 3;
+   e22_environment[e22.variable_slot("c")] = 4;
+   vector<long double> e22_parallel{e22_environment};
+   Thread_Pool         pool{4};
+
+   cout << "program: " << e22.statement_count() << " satser, "
+        << e22.level_count() << " nivåer\n";
+   cout << "värde: " << e22.evaluate(e22_environment.data())
+        << ", parallellt: " << e22.evaluate(e22_parallel.data(), pool) << '\n';
+   cout << "t = " << e22_environment[e22.variable_slot("t")]
+        << ", u = " << e22_environment[e22.variable_slot("u")]
+        << ", w = " << e22_environment[e22.variable_slot("w")]
+        << ", samma miljö parallellt: " << boolalpha
+        << (e22_environment == e22_parallel) << noboolalpha << '\n';
+
+   Expression_Program e22_float{make_program("t = 1 / 3; t + 0.1",
+                                             Expression_Options{false, false,
+                                                                Number_Type::float_type})};
+   cout << "program i float: " << boolalpha
+        << (e22_float.evaluate() == 1.0f / 3.0f + 0.1f) << noboolalpha << '\n';
+
+   Expression_Program e22_bad;
+   Expression_Status  e22_status{try_make_program("t = a * b\nu = t + * c", e22_bad)};
+   cout << "fel i program vid position " << e22_status.position << ": "
+        << e22_status.message() << '\n';
+
+   // Ett stort genererat polynom räknas på poolens trådar, med exakt samma
+   // värde som på en tråd.
+   string e23_text;
+   for (int i{0}; i < 5000; ++i)
+   {
+      e23_text += (i == 0 ? "" : i % 3 == 0 ? " - " : " + ");
+      e23_text += to_string(i % 17 + 1) + " * x ^ " + to_string(i % 5) + " * y ^ "
+                  + to_string(i % 3) + " / (z + " + to_string(i % 7 + 1) + ")";
+   }
+   Expression          e23{make_expression(e23_text)};
+   vector<long double> e23_environment{e23.make_environment()};
+   e23_environment[e23.variable_slot("x")] = 1.25;
+   e23_environment[e23.variable_slot("y")] = -0.5;
+   e23_environment[e23.variable_slot("z")] = 3;
+   long double e23_value{e23.evaluate(e23_environment.data())};
+   cout << "stort uttryck: " << e23_value << ", samma värde parallellt: " << boolalpha
+        << (e23.evaluate(e23_environment.data(), pool) == e23_value) << noboolalpha << '\n';
+
+   // Samma sak för ett högernästlat uttryck, x * y / (z + 1) + (x * y / ...),
+   // vars stack är lika djup som uttrycket är långt.
+   string e23_nested;
+   for (int i{0}; i < 20000; ++i)
+      e23_nested += "x * y / (z + " + to_string(i % 7 + 1) + ") + (";
+   e23_nested += "x" + string(20000, ')');
+   Expression          e23_right{make_expression(e23_nested)};
+   vector<long double> e23_right_environment{e23_right.make_environment()};
+   e23_right_environment[e23_right.variable_slot("x")] = 1.25;
+   e23_right_environment[e23_right.variable_slot("y")] = -0.5;
+   e23_right_environment[e23_right.variable_slot("z")] = 3;
+   long double e23_right_value{e23_right.evaluate(e23_right_environment.data())};
+   cout << "högernästlat: " << e23_right_value << ", samma värde parallellt: " << boolalpha
+        << (e23_right.evaluate(e23_right_environment.data(), pool) == e23_right_value)
+        << noboolalpha
+        << "\n\n";
+
+   // Flera trådar utvärderar samma uttryck samtidigt, var och en med egen kontext.
+   const Expression shared{make_expression("t = (a + 1) * (a - 1) / 2 ^ a")};
+   const unsigned   thread_count{16};
+   const int        rounds{20000};
+   atomic<int>      errors{0};
+   vector<thread>   threads;
+
+   for (unsigned i{0}; i < thread_count; ++i)
+   {
+      threads.emplace_back([&shared, &errors, i, rounds]
+      {
+         Evaluation_Context context{shared.make_context()};
+         const std::size_t  a{shared.variable_slot("a")};
+         const std::size_t  t{shared.variable_slot("t")};
+
+         for (int n{0}; n < rounds; ++n)
+         {
+            long double value = i + n % 7;
+            context[a] = value;
+            long double expected{(value + 1) * (value - 1) / pow(2.0L, value)};
+            if (shared.evaluate(context) != expected || context[t] != expected)
+               ++errors;
+         }
+      });
+   }
+   for (thread& t : threads)
+      t.join();
+
+   cout << "fel vid samtidig utvärdering: " << errors << "\n\n";
 
    return 0;
 }
@@ -8,7 +8,7 @@ using namespace std;
 
 int main()
 {
-   // Ska inte vara mjligt - Expression_Tree ska vara abstrakt:
+   // Ska inte vara möjligt - Expression_Tree ska vara abstrakt:
    // Expression_Tree* t0{new Expression_Tree};
 
   //Expression_Tree* t1{ new Plus{ new Integer{9}, new Minus{ new Real{3.14}, new Divide{ new Integer{8}, new Integer{2} }  } }};
@@ -37,7 +37,7 @@ int main()
    }
    catch (const exception& e)
    {
-      cout << "Undantag fngat: " << e.what() << '\n';
+      cout << "Undantag fångat: " << e.what() << '\n';
    }
 
    cout << "t1->get_postfix() = " << t1->get_postfix() << '\n';
@@ -51,7 +51,7 @@ int main()
    }
    catch (const exception& e)
    {
-      cout << "Undantag fngat: " << e.what() << '\n';
+      cout << "Undantag fångat: " << e.what() << '\n';
    }
    cout << "t2->get_postfix() = " << t2->get_postfix() << '\n';
    cout << "t2->str() = " << t2->str() << "\n\n";*/